@@ -1,27 +1,56 @@
-
 #include <stdio.h>
 #include <string.h>
 #include <termios.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <fcntl.h>
 #include <stdlib.h>
-#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
 #include <unistd.h>
 
 #include "cssl.h"
 
-static int CSSL_SIGNAL=0;
+/* max events fetched per epoll_wait round */
+#define CSSL_MAX_EVENTS 32
+
 static int cssl_started=0;
 
-static struct sigaction sa;
-static struct sigaction oldsa;
+/* the reactor: one epoll instance and one thread serving all ports */
+static int cssl_epfd=-1;
+static int cssl_wakefd=-1;
+static int cssl_reactor_running=0;
+static pthread_t cssl_reactor;
+
+/* the decoder: drains the port rings and runs the callbacks */
+static int cssl_decoder_running=0;
+static pthread_t cssl_decoder;
+
+/* guards the port list, the pending queue, the round
+   counters and the graveyard */
+static pthread_mutex_t cssl_mutex=PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cssl_round_cond=PTHREAD_COND_INITIALIZER;
+static pthread_cond_t cssl_pending_cond=PTHREAD_COND_INITIALIZER;
+static unsigned long cssl_round=0;
+static unsigned long cssl_decode_round=0;
 
 static cssl_t *head=0;
+/* ports with unread bytes in their ring, in arrival order */
+static cssl_t *pending_head=0;
+static cssl_t *pending_tail=0;
+/* port whose ring the decoder is draining right now */
+static cssl_t *decoding=0;
+/* ports closed from inside a callback, freed by the decoder */
+static cssl_t *graveyard=0;
 
 static const char *cssl_errors[]= {
     "cssl: OK",
-    "cssl: there's no free signal",
+    "cssl: cannot start the i/o reactor",
     "cssl: not started",
     "cssl: null pointer",
     "cssl: oops",
@@ -29,9 +58,11 @@ static const char *cssl_errors[]= {
     "cssl: cannot open file"
 };
 
-static cssl_error_t cssl_error=CSSL_OK;
+/* per thread, like errno: probes open and set up ports concurrently */
+static __thread cssl_error_t cssl_error=CSSL_OK;
 
-static void cssl_handler(int signo, siginfo_t *info, void *ignored);
+static void *cssl_reactor_loop(void *arg);
+static void *cssl_decoder_loop(void *arg);
 
 const char *cssl_geterrormsg()
 {
@@ -45,59 +76,95 @@ int cssl_geterror()
 
 void cssl_start()
 {
-    int sig;
-    if (cssl_started) { return; }
-
-    /* Here we scan for unused real time signal */
-    sig=SIGRTMIN;
-
-    do {
-	
-	/* get old sigaction */
-	sigaction(sig,0,&oldsa);
-	
-	/* if signal's handler is empty */
-	if (oldsa.sa_handler == 0) 
-	{
-	    /* set the signal handler, and others */
-	    CSSL_SIGNAL=sig;
-	    sa.sa_sigaction = cssl_handler;
-	    sa.sa_flags = SA_SIGINFO;
-	    sa.sa_restorer = NULL;
-	    sigemptyset(&sa.sa_mask);
-	    sigaction(CSSL_SIGNAL,&sa,0);
-
-	    /* OK, the cssl is started */
-	    cssl_started=1;
-	    cssl_error=CSSL_OK;
-	    return;
-	} else {
-	    /* signal handler was not empty, 
-	       restore original */
-	    sigaction(CSSL_SIGNAL,&oldsa,0);
-	}
-	sig++;
-    } while(sig<=SIGRTMAX);
-    
+    struct epoll_event ev;
 
-    /* Sorry, there's no free signal */
-    cssl_error=CSSL_ERROR_NOSIGNAL;
-    
+    pthread_mutex_lock(&cssl_mutex);
+    if (cssl_started) {
+	pthread_mutex_unlock(&cssl_mutex);
+	return;
+    }
+
+    /* one epoll instance for every port, plus an eventfd
+       used to kick the reactor out of epoll_wait */
+    cssl_epfd=epoll_create1(EPOLL_CLOEXEC);
+    cssl_wakefd=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+    if (cssl_epfd<0 || cssl_wakefd<0)
+	goto fail;
+
+    memset(&ev,0,sizeof(ev));
+    ev.events=EPOLLIN;
+    ev.data.ptr=NULL;
+    if (epoll_ctl(cssl_epfd,EPOLL_CTL_ADD,cssl_wakefd,&ev)<0)
+	goto fail;
+
+    cssl_decoder_running=1;
+    if (pthread_create(&cssl_decoder,NULL,cssl_decoder_loop,NULL)!=0) {
+	cssl_decoder_running=0;
+	goto fail;
+    }
+
+    cssl_reactor_running=1;
+    if (pthread_create(&cssl_reactor,NULL,cssl_reactor_loop,NULL)!=0) {
+	cssl_reactor_running=0;
+	cssl_decoder_running=0;
+	pthread_cond_signal(&cssl_pending_cond);
+	pthread_mutex_unlock(&cssl_mutex);
+	pthread_join(cssl_decoder,NULL);
+	pthread_mutex_lock(&cssl_mutex);
+	goto fail;
+    }
+
+    /* OK, the cssl is started */
+    cssl_started=1;
+    cssl_error=CSSL_OK;
+    pthread_mutex_unlock(&cssl_mutex);
+    return;
+
+ fail:
+    if (cssl_wakefd>=0)
+	close(cssl_wakefd);
+    if (cssl_epfd>=0)
+	close(cssl_epfd);
+    cssl_wakefd=cssl_epfd=-1;
+    cssl_error=CSSL_ERROR_REACTOR;
+    pthread_mutex_unlock(&cssl_mutex);
+}
+
+/* wakes the reactor up from epoll_wait */
+static void cssl_wake()
+{
+    uint64_t one=1;
+
+    write(cssl_wakefd,&one,sizeof(one));
 }
 
 /* stops the cssl */
 void cssl_stop()
 {
+    pthread_mutex_lock(&cssl_mutex);
+
     /* if not started we do nothing */
-    if (!cssl_started)
+    if (!cssl_started) {
+	pthread_mutex_unlock(&cssl_mutex);
 	return;
+    }
+
+    /* first the i/o threads go away, so nobody dispatches anymore */
+    cssl_reactor_running=0;
+    cssl_decoder_running=0;
+    cssl_wake();
+    pthread_cond_signal(&cssl_pending_cond);
+    pthread_mutex_unlock(&cssl_mutex);
+    pthread_join(cssl_reactor,NULL);
+    pthread_join(cssl_decoder,NULL);
 
     /* we close all ports, and free the list */
     while (head)
 	cssl_close(head);
 
-    /* then we remove the signal handler */
-    sigaction(CSSL_SIGNAL,&oldsa,NULL);
+    close(cssl_wakefd);
+    close(cssl_epfd);
+    cssl_wakefd=cssl_epfd=-1;
 
     /* And at least : */
     cssl_started=0;
@@ -136,20 +203,22 @@ cssl_t *cssl_open(const char *fname,
 
     /* opening the file */
     if(callback) {
-	/* user wants event driven reading */
-	serial->fd=open(fname,O_RDWR|O_NOCTTY|O_NONBLOCK);
-	fcntl(serial->fd,F_SETSIG,CSSL_SIGNAL);
-	fcntl(serial->fd,F_SETOWN,getpid());
-	fcntl(serial->fd,F_SETFL,O_ASYNC|O_NONBLOCK );
+	/* user wants event driven reading, the reactor
+	   will drain the port with non-blocking reads */
+	serial->fd=open(fname,O_RDWR|O_NOCTTY|O_NONBLOCK|O_CLOEXEC);
     } else {
 	/* the read/write operations will be bloking */
 	serial->fd=open(fname,O_RDWR|O_NOCTTY|O_NDELAY);
     }
 
-    /* oops, cannot open */
+    /* oops, cannot open; errno is left for the caller to
+       tell a node still being set up from a dead one */
     if (serial->fd == -1) {
+	int err=errno;
+
 	cssl_error=CSSL_ERROR_OPEN;
 	free(serial);
+	errno=err;
 	return NULL;
     }
 
@@ -166,20 +235,73 @@ cssl_t *cssl_open(const char *fname,
     serial->callback=callback;
     
     /* we add the serial to our list */
+    pthread_mutex_lock(&cssl_mutex);
     serial->next=head;
     head=serial;
-	
+
+    /* and hand it over to the reactor */
+    if (callback) {
+	struct epoll_event ev;
+
+	memset(&ev,0,sizeof(ev));
+	ev.events=EPOLLIN;
+	ev.data.ptr=serial;
+	epoll_ctl(cssl_epfd,EPOLL_CTL_ADD,serial->fd,&ev);
+    }
+    pthread_mutex_unlock(&cssl_mutex);
+
     cssl_error=CSSL_OK;
 
     return serial;
 }
 
 
+/* unlinks serial from the list, called with cssl_mutex held */
+static int cssl_unlink(cssl_t *serial)
+{
+    cssl_t *cur;
+
+    if (head==serial) {
+	head=serial->next;
+	return 1;
+    }
+
+    for (cur=head;cur;cur=cur->next) {
+	if (cur->next==serial) {
+	    cur->next=serial->next;
+	    return 1;
+	}
+    }
+
+    return 0;
+}
+
+/* drops serial from the pending queue, called with cssl_mutex held */
+static void cssl_unqueue(cssl_t *serial)
+{
+    cssl_t *cur, *prev=0;
+
+    for (cur=pending_head;cur;prev=cur,cur=cur->pending_next) {
+	if (cur==serial) {
+	    if (prev)
+		prev->pending_next=cur->pending_next;
+	    else
+		pending_head=cur->pending_next;
+	    if (pending_tail==cur)
+		pending_tail=prev;
+	    break;
+	}
+    }
+    serial->pending_next=0;
+    serial->queued=0;
+}
+
 /* closes file, removes serial from the list and frees it */
 void cssl_close(cssl_t *serial)
 {
-    cssl_t *cur;
-    
+    int in_decoder;
+    int cancelstate;
+
     if (!cssl_started) {
 	cssl_error=CSSL_ERROR_NOTSTARTED;
 	return;
@@ -189,7 +311,51 @@ void cssl_close(cssl_t *serial)
 	cssl_error=CSSL_ERROR_NULLPOINTER;
 	return;
     }
-    
+
+    pthread_mutex_lock(&cssl_mutex);
+
+    /* now we can remove the serial from the list */
+    if (!cssl_unlink(serial)) {
+	/* we should never reach there,
+	   it means, that serial was not found in the list */
+	pthread_mutex_unlock(&cssl_mutex);
+	cssl_error=CSSL_ERROR_OOPS;
+	return;
+    }
+
+    /* no more events nor callbacks for this port */
+    serial->closing=1;
+    epoll_ctl(cssl_epfd,EPOLL_CTL_DEL,serial->fd,NULL);
+    if (serial->queued)
+	cssl_unqueue(serial);
+
+    in_decoder=cssl_decoder_running &&
+	pthread_equal(pthread_self(),cssl_decoder);
+
+    /* a cancelled waiter would leave cssl_mutex locked */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE,&cancelstate);
+
+    if (cssl_reactor_running) {
+	/* the reactor may still hold this port in the events
+	   of its current round, wait until that round is over */
+	unsigned long round=cssl_round;
+
+	cssl_wake();
+	while (cssl_round==round && cssl_reactor_running)
+	    pthread_cond_wait(&cssl_round_cond,&cssl_mutex);
+    }
+
+    if (!in_decoder && decoding==serial) {
+	/* the decoder is inside this port's callback */
+	unsigned long round=cssl_decode_round;
+
+	while (cssl_decode_round==round && cssl_decoder_running)
+	    pthread_cond_wait(&cssl_round_cond,&cssl_mutex);
+    }
+
+    pthread_setcancelstate(cancelstate,NULL);
+    pthread_mutex_unlock(&cssl_mutex);
+
     /* first we flush the port */
     tcflush(serial->fd,TCOFLUSH); 
     tcflush(serial->fd,TCIFLUSH); 
@@ -199,28 +365,20 @@ void cssl_close(cssl_t *serial)
     
     /* and close the file */
     close(serial->fd);
-    
-    /* now we can remove the serial from the list */
-
-    if (head==serial) {
-	head=serial->next;
+    serial->fd=-1;
+
+    if (in_decoder) {
+	/* closed from a callback: the decoder still refers
+	   to it, it frees it once the callback returned */
+	pthread_mutex_lock(&cssl_mutex);
+	serial->next=graveyard;
+	graveyard=serial;
+	pthread_mutex_unlock(&cssl_mutex);
+    } else {
 	free(serial);
-	cssl_error=CSSL_OK;
-	return;
-    }
-
-    for (cur=head;cur;cur=cur->next) {
-	if (cur->next==serial) {
-	    cur->next=serial->next;
-	    free(serial);
-	    cssl_error=CSSL_OK;
-	    return;
-	}
     }
 
-    /* we should never reach there,
-       it means, that serial was not found in the list */
-    cssl_error=CSSL_ERROR_OOPS;
+    cssl_error=CSSL_OK;
 }
 
 
@@ -228,6 +386,16 @@ void cssl_close(cssl_t *serial)
  * Port setup
  */
 
+/* sends serial->tio to the port; tcsetattr only knows the Bxxx
+   rates, so a custom rate has to be put back after every call */
+static void cssl_apply(cssl_t *serial)
+{
+    tcsetattr(serial->fd,TCSANOW,&(serial->tio));
+
+    if (serial->custom_baud)
+	cssl_set_custom_baud(serial->fd,serial->custom_baud);
+}
+
 /* sets up the port parameters */
 void cssl_setup(cssl_t *serial,
 		   int baud,
@@ -294,10 +462,54 @@ void cssl_setup(cssl_t *serial,
     case 115200:
 	baudrate=B115200;
 	break;
+    case 230400:
+	baudrate=B230400;
+	break;
+    case 460800:
+	baudrate=B460800;
+	break;
+    case 500000:
+	baudrate=B500000;
+	break;
+    case 576000:
+	baudrate=B576000;
+	break;
+    case 921600:
+	baudrate=B921600;
+	break;
+    case 1000000:
+	baudrate=B1000000;
+	break;
+    case 1152000:
+	baudrate=B1152000;
+	break;
+    case 1500000:
+	baudrate=B1500000;
+	break;
+    case 2000000:
+	baudrate=B2000000;
+	break;
+    case 2500000:
+	baudrate=B2500000;
+	break;
+    case 3000000:
+	baudrate=B3000000;
+	break;
+    case 3500000:
+	baudrate=B3500000;
+	break;
+    case 4000000:
+	baudrate=B4000000;
+	break;
     default:
-	baudrate=B9600;
+	/* anything else goes through termios2, the
+	   placeholder rate below is replaced by cssl_apply */
+	baudrate=(baud>0) ? B38400 : B9600;
     }
 
+    serial->custom_baud=(baud>0 && baudrate==B38400 && baud!=38400) ? baud : 0;
+    serial->baud=(baud>0) ? baud : 9600;
+
     /* databits */
     switch (bits) {
     case 7:
@@ -353,14 +565,14 @@ void cssl_setup(cssl_t *serial,
     serial->tio.c_cc[VTIME] = 5;
     cfsetispeed(&serial->tio, baudrate);
     cfsetospeed(&serial->tio, baudrate);
-    tcsetattr(serial->fd, TCSANOW, &serial->tio);
+    cssl_apply(serial);
 
     /* we flush the port */
     tcflush(serial->fd,TCOFLUSH);
     tcflush(serial->fd,TCIFLUSH);
     
     /* we send new config to the port */
-    tcsetattr(serial->fd,TCSANOW,&(serial->tio));
+    cssl_apply(serial);
 
     cssl_error=CSSL_OK;
 }
@@ -393,7 +605,7 @@ void cssl_setflowcontrol(cssl_t *serial,
 	serial->tio.c_iflag &= ~(IXON|IXOFF);
     }
     
-    tcsetattr(serial->fd,TCSANOW,&(serial->tio));
+    cssl_apply(serial);
 
     cssl_error=CSSL_OK;
 }
@@ -416,7 +628,7 @@ void cssl_settimeout(cssl_t *serial, int timeout)
 
     serial->tio.c_cc[VTIME]=timeout;
     
-    tcsetattr(serial->fd,TCSANOW,&(serial->tio));
+    cssl_apply(serial);
 
     cssl_error=CSSL_OK;
 }
@@ -504,24 +716,234 @@ int cssl_getdata(cssl_t *serial,
     return read(serial->fd,buffer,size);
 }
 
-void cssl_handler(int signo, siginfo_t *info, void *ignored)
+/* returns the ring statistics of the port */
+void cssl_getstats(cssl_t *serial, cssl_stats_t *stats)
 {
-    cssl_t *cur;
-    int n;int ext_ascii_bytes; uint8_t rx_buf[280];
-    if (info->si_code==POLL_IN) {
-	for(cur=head;cur;cur=cur->next) {
-	    if (cur->fd==info->si_fd) {
-        ext_ascii_bytes =  read(cur->fd, rx_buf, sizeof(rx_buf));
-		n=read(cur->fd,cur->buffer,255);
-        if ((ext_ascii_bytes > 0)&&((cur->callback))){
-            cur->callback(cur->id,rx_buf,ext_ascii_bytes);
-            return;
-        }
-        else if ((n>0)&&(cur->callback))
-		    cur->callback(cur->id,cur->buffer,n);
-		return;
-	    }
+    if (!serial || !stats) {
+	cssl_error=CSSL_ERROR_NULLPOINTER;
+	return;
+    }
+
+    stats->rx_bytes=atomic_load_explicit(&serial->rx_bytes,memory_order_relaxed);
+    stats->ring_high_water=atomic_load_explicit(&serial->ring_high_water,memory_order_relaxed);
+    stats->overflow_drops=atomic_load_explicit(&serial->overflow_drops,memory_order_relaxed);
+    cssl_error=CSSL_OK;
+}
+
+/* reads the driver's line error counters, returns -1
+   when the driver keeps none (pty, most usb-serial) */
+int cssl_geticount(cssl_t *serial, cssl_icount_t *icount)
+{
+    struct serial_icounter_struct ic;
+
+    if (!serial || !icount) {
+	cssl_error=CSSL_ERROR_NULLPOINTER;
+	return -1;
+    }
+
+    memset(icount,0,sizeof(*icount));
+    if (ioctl(serial->fd,TIOCGICOUNT,&ic)<0)
+	return -1;
+
+    icount->frame=ic.frame;
+    icount->parity=ic.parity;
+    icount->overrun=ic.overrun;
+    icount->brk=ic.brk;
+    cssl_error=CSSL_OK;
+    return 0;
+}
+
+/* queues serial for the decoder unless it is already queued */
+static void cssl_enqueue(cssl_t *serial)
+{
+    pthread_mutex_lock(&cssl_mutex);
+    if (!serial->queued && !serial->closing) {
+	serial->queued=1;
+	serial->pending_next=0;
+	if (pending_tail)
+	    pending_tail->pending_next=serial;
+	else
+	    pending_head=serial;
+	pending_tail=serial;
+	pthread_cond_signal(&cssl_pending_cond);
+    }
+    pthread_mutex_unlock(&cssl_mutex);
+}
+
+/* producer side: moves everything pending on the port into its ring */
+static void cssl_fill(cssl_t *serial)
+{
+    static uint8_t scratch[4096];
+    struct iovec iov[2];
+    size_t head, tail, used, free_bytes, off;
+    ssize_t n;
+    int iovcnt, got=0;
+
+    for (;;) {
+	head=atomic_load_explicit(&serial->ring_head,memory_order_relaxed);
+	tail=atomic_load_explicit(&serial->ring_tail,memory_order_acquire);
+	free_bytes=CSSL_RING_SIZE-(head-tail);
+
+	if (free_bytes==0) {
+	    /* the decoder fell behind: keep the port drained so
+	       epoll does not spin, and account for the loss */
+	    n=read(serial->fd,scratch,sizeof(scratch));
+	    if (n<=0)
+		break;
+	    atomic_fetch_add_explicit(&serial->overflow_drops,n,memory_order_relaxed);
+	    continue;
+	}
+
+	/* read straight into the free space, which may wrap */
+	off=head&(CSSL_RING_SIZE-1);
+	iov[0].iov_base=serial->ring+off;
+	if (off+free_bytes<=CSSL_RING_SIZE) {
+	    iov[0].iov_len=free_bytes;
+	    iovcnt=1;
+	} else {
+	    iov[0].iov_len=CSSL_RING_SIZE-off;
+	    iov[1].iov_base=serial->ring;
+	    iov[1].iov_len=free_bytes-iov[0].iov_len;
+	    iovcnt=2;
+	}
+
+	n=readv(serial->fd,iov,iovcnt);
+	if (n<=0)
+	    break;
+
+	atomic_store_explicit(&serial->ring_head,head+n,memory_order_release);
+	atomic_fetch_add_explicit(&serial->rx_bytes,n,memory_order_relaxed);
+	used=head+n-tail;
+	if (used>atomic_load_explicit(&serial->ring_high_water,memory_order_relaxed))
+	    atomic_store_explicit(&serial->ring_high_water,used,memory_order_relaxed);
+	got=1;
+
+	/* a short read means the port is empty */
+	if ((size_t)n<free_bytes)
+	    break;
+    }
+
+    if (got)
+	cssl_enqueue(serial);
+}
+
+/* consumer side: hands the ring content to the callback, in place */
+static void cssl_consume(cssl_t *serial)
+{
+    size_t head, tail, off, len;
+
+    for (;;) {
+	tail=atomic_load_explicit(&serial->ring_tail,memory_order_relaxed);
+	head=atomic_load_explicit(&serial->ring_head,memory_order_acquire);
+	if (head==tail || serial->closing)
+	    return;
+
+	/* contiguous part up to the end of the ring */
+	off=tail&(CSSL_RING_SIZE-1);
+	len=head-tail;
+	if (off+len>CSSL_RING_SIZE)
+	    len=CSSL_RING_SIZE-off;
+
+	if (serial->callback)
+	    serial->callback(serial->id,serial->ring+off,(int)len);
+
+	atomic_store_explicit(&serial->ring_tail,tail+len,memory_order_release);
+    }
+}
+
+static void *cssl_decoder_loop(void *arg)
+{
+    cssl_t *serial, *dead;
+
+    (void)arg;
+
+    pthread_mutex_lock(&cssl_mutex);
+    for (;;) {
+	while (!pending_head && cssl_decoder_running)
+	    pthread_cond_wait(&cssl_pending_cond,&cssl_mutex);
+	if (!cssl_decoder_running)
+	    break;
+
+	serial=pending_head;
+	pending_head=serial->pending_next;
+	if (!pending_head)
+	    pending_tail=0;
+	serial->pending_next=0;
+	/* cleared before draining, so bytes arriving meanwhile
+	   queue the port again */
+	serial->queued=0;
+	decoding=serial;
+	pthread_mutex_unlock(&cssl_mutex);
+
+	cssl_consume(serial);
+
+	pthread_mutex_lock(&cssl_mutex);
+	decoding=0;
+	cssl_decode_round++;
+	pthread_cond_broadcast(&cssl_round_cond);
+	while (graveyard) {
+	    dead=graveyard;
+	    graveyard=dead->next;
+	    free(dead);
 	}
     }
+    pthread_mutex_unlock(&cssl_mutex);
+
+    return NULL;
 }
 
+static void *cssl_reactor_loop(void *arg)
+{
+    struct epoll_event events[CSSL_MAX_EVENTS];
+    cssl_t *serial;
+    uint64_t kicks;
+    int n, i;
+
+    (void)arg;
+
+    for (;;) {
+	n=epoll_wait(cssl_epfd,events,CSSL_MAX_EVENTS,-1);
+	if (n<0 && errno!=EINTR) {
+	    /* nothing sane left to do, don't keep closers waiting */
+	    pthread_mutex_lock(&cssl_mutex);
+	    cssl_reactor_running=0;
+	    pthread_cond_broadcast(&cssl_round_cond);
+	    pthread_mutex_unlock(&cssl_mutex);
+	    break;
+	}
+
+	for (i=0;i<n;i++) {
+	    serial=(cssl_t *)events[i].data.ptr;
+	    if (serial==NULL) {
+		read(cssl_wakefd,&kicks,sizeof(kicks));
+		continue;
+	    }
+	    if (serial->closing)
+		continue;
+
+	    if (events[i].events & EPOLLIN)
+		cssl_fill(serial);
+
+	    if (events[i].events & (EPOLLHUP|EPOLLERR)) {
+		/* the device went away, stop polling it until the
+		   owner closes it, otherwise we spin on the hangup */
+		pthread_mutex_lock(&cssl_mutex);
+		if (!serial->closing)
+		    epoll_ctl(cssl_epfd,EPOLL_CTL_DEL,serial->fd,NULL);
+		pthread_mutex_unlock(&cssl_mutex);
+	    }
+	}
+
+	/* end of round: release closers */
+	pthread_mutex_lock(&cssl_mutex);
+	cssl_round++;
+	pthread_cond_broadcast(&cssl_round_cond);
+	if (!cssl_reactor_running) {
+	    pthread_mutex_unlock(&cssl_mutex);
+	    break;
+	}
+	pthread_mutex_unlock(&cssl_mutex);
+    }
+
+    return NULL;
+}
@@ -2,25 +2,55 @@
 #define __CSSL_H__
 
 #include <stdint.h>
-#include <signal.h>
+#include <stddef.h>
+#include <stdatomic.h>
 #include <termios.h>
 
+/* per-port receive ring, must be a power of two; 64k holds
+   about 0.7s of a saturated 921600 baud link */
+#define CSSL_RING_SIZE 65536
+
 
 typedef void (*cssl_callback_t)(int id, uint8_t *buffer, int len);
 
 typedef struct __cssl_t {
-    uint8_t buffer[255];
+    /* single producer (reactor) / single consumer (decoder) ring */
+    uint8_t ring[CSSL_RING_SIZE];
+    atomic_size_t ring_head;
+    atomic_size_t ring_tail;
+    atomic_ulong rx_bytes;
+    atomic_ulong ring_high_water;
+    atomic_ulong overflow_drops;
     int fd;
     struct termios tio;
     struct termios oldtio;
     cssl_callback_t callback;
     int id;
+    int baud;         /* rate the port is set to */
+    int custom_baud;  /* non-zero when set through termios2 */
+    atomic_int closing;
+    int queued;
+    struct __cssl_t *pending_next;
     struct __cssl_t *next;
 } cssl_t;
 
+typedef struct {
+    unsigned long rx_bytes;
+    unsigned long ring_high_water;
+    unsigned long overflow_drops;
+} cssl_stats_t;
+
+/* line error counters kept by the uart driver */
+typedef struct {
+    unsigned long frame;
+    unsigned long parity;
+    unsigned long overrun;
+    unsigned long brk;
+} cssl_icount_t;
+
 typedef enum {
     CSSL_OK,
-    CSSL_ERROR_NOSIGNAL,
+    CSSL_ERROR_REACTOR,
     CSSL_ERROR_NOTSTARTED,
     CSSL_ERROR_NULLPOINTER,
     CSSL_ERROR_OOPS,
@@ -35,6 +65,8 @@ void cssl_stop();
 cssl_t *cssl_open(const char *fname, cssl_callback_t callback, int id, int baud, int bits, int parity,int stop);
 void cssl_close(cssl_t *serial);
 void cssl_setup(cssl_t *serial, int baud, int bits, int parity, int stop);
+/* any integer rate through termios2/BOTHER, from cssl_termios2.c */
+int cssl_set_custom_baud(int fd, int baud);
 void cssl_setflowcontrol(cssl_t *serial, int rtscts, int xonxoff);
 void cssl_putchar(cssl_t *serial, char c);
 void cssl_putstring(cssl_t *serial, char *str);
@@ -43,6 +75,8 @@ void cssl_drain(cssl_t *serial);
 void cssl_settimeout(cssl_t *serial, int timeout);
 int cssl_getchar(cssl_t *serial);
 
-int cssl_getdata(cssl_t *serial, uint8_t *buffer, int size);      
+int cssl_getdata(cssl_t *serial, uint8_t *buffer, int size);
+void cssl_getstats(cssl_t *serial, cssl_stats_t *stats);
+int cssl_geticount(cssl_t *serial, cssl_icount_t *icount);      
 
 #endif 
\ No newline at end of file
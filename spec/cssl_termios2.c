@@ -0,0 +1,26 @@
+/* Custom baudrates through the Linux termios2 interface.
+ *
+ * Kept apart from cssl.c: <asm/termbits.h> redefines struct termios
+ * and cannot share a translation unit with the glibc <termios.h>.
+ */
+
+#include <sys/ioctl.h>
+#include <asm/termbits.h>
+
+int cssl_set_custom_baud(int fd, int baud)
+{
+    struct termios2 tio2;
+
+    if (ioctl(fd,TCGETS2,&tio2)<0)
+	return -1;
+
+    /* BOTHER: take the rate from c_ispeed/c_ospeed as is */
+    tio2.c_cflag &= ~CBAUD;
+    tio2.c_cflag |= BOTHER;
+    tio2.c_cflag &= ~(CBAUD<<IBSHIFT);
+    tio2.c_cflag |= BOTHER<<IBSHIFT;
+    tio2.c_ispeed=baud;
+    tio2.c_ospeed=baud;
+
+    return ioctl(fd,TCSETS2,&tio2);
+}
@@ -6,5 +6,397 @@
 #include <termios.h>
 #include <errno.h>
 #include <time.h>
+#include <pthread.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
-#include <libmavlink.h>
\ No newline at end of file
+#include <libmavlink.h>
+
+// MAVLINK_MESSAGE_CRCS indexed by id, built by libmavlink_init rather
+// than generated. Ids below 256, all MAVLink 1 can carry, are a direct
+// lookup in page 0; the 24-bit MAVLink 2 ids go through a page of 256
+// entries per id >> 8, for the pages that hold messages. The pages are
+// counted from the dialect, so every entry gets one.
+static const mavlink_msg_entry_t msg_entries[] = MAVLINK_MESSAGE_CRCS;
+static const mavlink_msg_entry_t *(*msg_entry_pages)[256];
+static uint16_t msg_entry_page_of[1 << 16]; // id >> 8 to its page, 0 if none above id 255
+
+static void msg_entry_init(void) {
+    int pages = 1;
+
+    for (size_t i = 0; i < sizeof(msg_entries) / sizeof(msg_entries[0]); i++) {
+        uint32_t page_id = msg_entries[i].msgid >> 8;
+        if (page_id && !msg_entry_page_of[page_id]) {
+            msg_entry_page_of[page_id] = pages++;
+        }
+    }
+    msg_entry_pages = calloc(pages, sizeof(*msg_entry_pages));
+    if (!msg_entry_pages) {
+        // Every frame would fail as unknown, there is no running without it
+        fprintf(stderr, "Failed to allocate the MAVLink message table\n");
+        abort();
+    }
+    for (size_t i = 0; i < sizeof(msg_entries) / sizeof(msg_entries[0]); i++) {
+        uint32_t msgid = msg_entries[i].msgid;
+        msg_entry_pages[msg_entry_page_of[msgid >> 8]][msgid & 0xFF] = &msg_entries[i];
+    }
+}
+
+// Only valid after libmavlink_init, which every parser goes through
+const mavlink_msg_entry_t *mavlink_get_msg_entry(uint32_t msgid) {
+    if (msgid < 256) {
+        return msg_entry_pages[0][msgid];
+    }
+    uint16_t page = msg_entry_page_of[(msgid >> 8) & 0xFFFF];
+    return page ? msg_entry_pages[page][msgid & 0xFF] : NULL;
+}
+
+// Slice-by-8 tables for the X.25 CRC of checksum.h (CRC-16/MCRF4XX),
+// derived from its crc_accumulate so both agree by construction.
+// crc_table[k][b] is the CRC contribution of byte b followed by k zeros.
+#define CRC_SLICES 8
+
+static uint16_t crc_table[CRC_SLICES][256];
+
+static void crc_table_init(void) {
+    for (int b = 0; b < 256; b++) {
+        uint16_t crc = 0;
+        crc_accumulate((uint8_t)b, &crc);
+        crc_table[0][b] = crc;
+    }
+    for (int k = 1; k < CRC_SLICES; k++) {
+        for (int b = 0; b < 256; b++) {
+            uint16_t prev = crc_table[k - 1][b];
+            crc_table[k][b] = (prev >> 8) ^ crc_table[0][prev & 0xFF];
+        }
+    }
+}
+
+// Same result as checksum.h's crc_accumulate_buffer, eight bytes per step.
+// Needs libmavlink_init for the tables.
+void libmavlink_crc_accumulate_buffer(uint16_t *crc_accum, const uint8_t *buf, size_t length) {
+    uint16_t crc = *crc_accum;
+
+    for (; length >= CRC_SLICES; length -= CRC_SLICES, buf += CRC_SLICES) {
+        crc = crc_table[7][buf[0] ^ (crc & 0xFF)] ^ crc_table[6][buf[1] ^ (crc >> 8)] ^
+              crc_table[5][buf[2]] ^ crc_table[4][buf[3]] ^
+              crc_table[3][buf[4]] ^ crc_table[2][buf[5]] ^
+              crc_table[1][buf[6]] ^ crc_table[0][buf[7]];
+    }
+    while (length--) {
+        crc = (crc >> 8) ^ crc_table[0][(crc ^ *buf++) & 0xFF];
+    }
+    *crc_accum = crc;
+}
+
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static void tables_init(void) {
+    msg_entry_init();
+    crc_table_init();
+}
+
+// Builds the lookup tables the parser and the CRC use, once. Parsers do it
+// on init, so the per-frame lookups need no check.
+void libmavlink_init(void) {
+    pthread_once(&tables_once, tables_init);
+}
+
+void libmavlink_parser_init(libmavlink_parser_t *parser) {
+    libmavlink_init();
+    memset(parser, 0, sizeof(*parser));
+    parser->status.parse_state = MAVLINK_PARSE_STATE_IDLE;
+}
+
+// Drops any partial frame but keeps the counters running
+void libmavlink_parser_resync(libmavlink_parser_t *parser) {
+    memset(&parser->rxmsg, 0, sizeof(parser->rxmsg));
+    memset(&parser->status, 0, sizeof(parser->status));
+    parser->status.parse_state = MAVLINK_PARSE_STATE_IDLE;
+}
+
+// The parser checks frames against the common message set only, so
+// ArduPilot's own messages fail their CRC. These are the ardupilotmega
+// messages common lacks, sorted by id, with their CRC_EXTRA.
+#define ARDUPILOTMEGA_ENTRY(name) \
+    { MAVLINK_MSG_ID_##name, MAVLINK_MSG_ID_##name##_CRC, \
+      MAVLINK_MSG_ID_##name##_MIN_LEN, MAVLINK_MSG_ID_##name##_LEN, 0, 0, 0 }
+
+static const mavlink_msg_entry_t ardupilotmega_entries[] = {
+    ARDUPILOTMEGA_ENTRY(SENSOR_OFFSETS),
+    ARDUPILOTMEGA_ENTRY(SET_MAG_OFFSETS),
+    ARDUPILOTMEGA_ENTRY(MEMINFO),
+    ARDUPILOTMEGA_ENTRY(AP_ADC),
+    ARDUPILOTMEGA_ENTRY(DIGICAM_CONFIGURE),
+    ARDUPILOTMEGA_ENTRY(DIGICAM_CONTROL),
+    ARDUPILOTMEGA_ENTRY(MOUNT_CONFIGURE),
+    ARDUPILOTMEGA_ENTRY(MOUNT_CONTROL),
+    ARDUPILOTMEGA_ENTRY(MOUNT_STATUS),
+    ARDUPILOTMEGA_ENTRY(FENCE_POINT),
+    ARDUPILOTMEGA_ENTRY(FENCE_FETCH_POINT),
+    ARDUPILOTMEGA_ENTRY(AHRS),
+    ARDUPILOTMEGA_ENTRY(SIMSTATE),
+    ARDUPILOTMEGA_ENTRY(HWSTATUS),
+    ARDUPILOTMEGA_ENTRY(RADIO),
+    ARDUPILOTMEGA_ENTRY(LIMITS_STATUS),
+    ARDUPILOTMEGA_ENTRY(WIND),
+    ARDUPILOTMEGA_ENTRY(DATA16),
+    ARDUPILOTMEGA_ENTRY(DATA32),
+    ARDUPILOTMEGA_ENTRY(DATA64),
+    ARDUPILOTMEGA_ENTRY(DATA96),
+    ARDUPILOTMEGA_ENTRY(RANGEFINDER),
+    ARDUPILOTMEGA_ENTRY(AIRSPEED_AUTOCAL),
+    ARDUPILOTMEGA_ENTRY(RALLY_POINT),
+    ARDUPILOTMEGA_ENTRY(RALLY_FETCH_POINT),
+    ARDUPILOTMEGA_ENTRY(COMPASSMOT_STATUS),
+    ARDUPILOTMEGA_ENTRY(AHRS2),
+    ARDUPILOTMEGA_ENTRY(CAMERA_STATUS),
+    ARDUPILOTMEGA_ENTRY(CAMERA_FEEDBACK),
+    ARDUPILOTMEGA_ENTRY(BATTERY2),
+    ARDUPILOTMEGA_ENTRY(AHRS3),
+    ARDUPILOTMEGA_ENTRY(AUTOPILOT_VERSION_REQUEST),
+    ARDUPILOTMEGA_ENTRY(REMOTE_LOG_DATA_BLOCK),
+    ARDUPILOTMEGA_ENTRY(REMOTE_LOG_BLOCK_STATUS),
+    ARDUPILOTMEGA_ENTRY(LED_CONTROL),
+    ARDUPILOTMEGA_ENTRY(MAG_CAL_PROGRESS),
+    ARDUPILOTMEGA_ENTRY(EKF_STATUS_REPORT),
+    ARDUPILOTMEGA_ENTRY(PID_TUNING),
+    ARDUPILOTMEGA_ENTRY(DEEPSTALL),
+    ARDUPILOTMEGA_ENTRY(GIMBAL_REPORT),
+    ARDUPILOTMEGA_ENTRY(GIMBAL_CONTROL),
+    ARDUPILOTMEGA_ENTRY(GIMBAL_TORQUE_CMD_REPORT),
+    ARDUPILOTMEGA_ENTRY(GOPRO_HEARTBEAT),
+    ARDUPILOTMEGA_ENTRY(GOPRO_GET_REQUEST),
+    ARDUPILOTMEGA_ENTRY(GOPRO_GET_RESPONSE),
+    ARDUPILOTMEGA_ENTRY(GOPRO_SET_REQUEST),
+    ARDUPILOTMEGA_ENTRY(GOPRO_SET_RESPONSE),
+    ARDUPILOTMEGA_ENTRY(RPM),
+    ARDUPILOTMEGA_ENTRY(DEVICE_OP_READ),
+    ARDUPILOTMEGA_ENTRY(DEVICE_OP_READ_REPLY),
+    ARDUPILOTMEGA_ENTRY(DEVICE_OP_WRITE),
+    ARDUPILOTMEGA_ENTRY(DEVICE_OP_WRITE_REPLY),
+    ARDUPILOTMEGA_ENTRY(ADAP_TUNING),
+    ARDUPILOTMEGA_ENTRY(VISION_POSITION_DELTA),
+    ARDUPILOTMEGA_ENTRY(AOA_SSA),
+    ARDUPILOTMEGA_ENTRY(ESC_TELEMETRY_1_TO_4),
+    ARDUPILOTMEGA_ENTRY(ESC_TELEMETRY_5_TO_8),
+    ARDUPILOTMEGA_ENTRY(ESC_TELEMETRY_9_TO_12),
+    ARDUPILOTMEGA_ENTRY(OSD_PARAM_CONFIG),
+    ARDUPILOTMEGA_ENTRY(OSD_PARAM_CONFIG_REPLY),
+    ARDUPILOTMEGA_ENTRY(OSD_PARAM_SHOW_CONFIG),
+    ARDUPILOTMEGA_ENTRY(OSD_PARAM_SHOW_CONFIG_REPLY),
+    ARDUPILOTMEGA_ENTRY(OBSTACLE_DISTANCE_3D),
+    ARDUPILOTMEGA_ENTRY(WATER_DEPTH),
+    ARDUPILOTMEGA_ENTRY(MCU_STATUS),
+};
+
+static const mavlink_msg_entry_t *ardupilotmega_entry(uint32_t msgid) {
+    size_t low = 0;
+    size_t high = sizeof(ardupilotmega_entries) / sizeof(ardupilotmega_entries[0]);
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (ardupilotmega_entries[mid].msgid == msgid) {
+            return &ardupilotmega_entries[mid];
+        }
+        if (ardupilotmega_entries[mid].msgid < msgid) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return NULL;
+}
+
+// Whether msgid is one of ArduPilot's own, i.e. not in common
+bool libmavlink_ardupilotmega_message(uint32_t msgid) {
+    return ardupilotmega_entry(msgid) != NULL;
+}
+
+// Recomputes the CRC of a received frame with another CRC_EXTRA. On a bad
+// CRC the parser leaves the one from the wire in msg->checksum.
+static bool frame_crc_matches(const mavlink_message_t *msg, bool mavlink1, uint8_t crc_extra) {
+    uint8_t header[MAVLINK_CORE_HEADER_LEN];
+    uint8_t n = 0;
+    uint16_t crc;
+
+    header[n++] = msg->len;
+    if (!mavlink1) {
+        header[n++] = msg->incompat_flags;
+        header[n++] = msg->compat_flags;
+    }
+    header[n++] = msg->seq;
+    header[n++] = msg->sysid;
+    header[n++] = msg->compid;
+    header[n++] = msg->msgid & 0xFF;
+    if (!mavlink1) {
+        header[n++] = (msg->msgid >> 8) & 0xFF;
+        header[n++] = (msg->msgid >> 16) & 0xFF;
+    }
+    crc_init(&crc);
+    libmavlink_crc_accumulate_buffer(&crc, header, n);
+    libmavlink_crc_accumulate_buffer(&crc, (const uint8_t *)_MAV_PAYLOAD(msg), msg->len);
+    crc_accumulate(crc_extra, &crc);
+    return crc == msg->checksum;
+}
+
+// A frame that failed the common CRC but is a valid ardupilotmega message.
+// Zero-fills the truncated payload tail like the parser does for its own.
+static bool ardupilotmega_frame(mavlink_message_t *msg, const mavlink_status_t *status) {
+    const mavlink_msg_entry_t *e = ardupilotmega_entry(msg->msgid);
+    bool mavlink1 = (status->flags & MAVLINK_STATUS_FLAG_IN_MAVLINK1) != 0;
+
+    if (!e || (msg->incompat_flags & MAVLINK_IFLAG_SIGNED) ||
+        !frame_crc_matches(msg, mavlink1, e->crc_extra)) {
+        return false;
+    }
+    if (msg->len < e->max_msg_len) {
+        memset(&_MAV_PAYLOAD_NON_CONST(msg)[msg->len], 0, e->max_msg_len - msg->len);
+    }
+    return true;
+}
+
+// Same contract as mavlink_parse_char(), but on caller supplied buffers
+uint8_t libmavlink_parse_char(libmavlink_parser_t *parser, uint8_t c,
+                              mavlink_message_t *r_message, mavlink_status_t *r_status) {
+    mavlink_status_t local_status;
+    mavlink_message_t local_message;
+    if (!r_status) {
+        r_status = &local_status;
+    }
+    if (!r_message) {
+        r_message = &local_message;
+    }
+
+    uint8_t msg_received = mavlink_frame_char_buffer(&parser->rxmsg, &parser->status,
+                                                     c, r_message, r_status);
+    if (msg_received == MAVLINK_FRAMING_BAD_CRC && ardupilotmega_frame(r_message, r_status)) {
+        msg_received = MAVLINK_FRAMING_OK;
+    }
+    // frame_char_buffer reports the errors of this byte as the drop count
+    if (r_status->packet_rx_drop_count) {
+        atomic_fetch_add_explicit(&parser->stats.parse_errors, r_status->packet_rx_drop_count,
+                                  memory_order_relaxed);
+    }
+    if (msg_received == MAVLINK_FRAMING_OK) {
+        atomic_fetch_add_explicit(&parser->stats.frames_ok, 1, memory_order_relaxed);
+    }
+    if (msg_received == MAVLINK_FRAMING_BAD_CRC ||
+        msg_received == MAVLINK_FRAMING_BAD_SIGNATURE) {
+        atomic_fetch_add_explicit(&parser->stats.crc_errors, 1, memory_order_relaxed);
+        // Treat a bad CRC as a parse failure and resync on this byte. Counted
+        // now: left to the next byte, the bulk parser that skips to the next
+        // start byte would report it late or not at all.
+        atomic_fetch_add_explicit(&parser->stats.parse_errors, 1, memory_order_relaxed);
+        parser->status.msg_received = MAVLINK_FRAMING_INCOMPLETE;
+        parser->status.parse_state = MAVLINK_PARSE_STATE_IDLE;
+        if (c == MAVLINK_STX) {
+            parser->status.parse_state = MAVLINK_PARSE_STATE_GOT_STX;
+            parser->rxmsg.len = 0;
+            mavlink_start_checksum(&parser->rxmsg);
+        }
+        return 0;
+    }
+    return msg_received;
+}
+
+// First byte in [p, end) that can start a frame, MAVLink 2 or 1, or end.
+// The vector width is picked at build time; AVX2 needs e.g. -mavx2, and
+// LIBMAVLINK_SCALAR_SCAN keeps only the byte loop (tests build it too).
+static const uint8_t *find_frame_start(const uint8_t *p, const uint8_t *end) {
+#if !defined(LIBMAVLINK_SCALAR_SCAN)
+#if defined(__AVX2__)
+    const __m256i stx2_32 = _mm256_set1_epi8((char)MAVLINK_STX);
+    const __m256i stx1_32 = _mm256_set1_epi8((char)MAVLINK_STX_MAVLINK1);
+    for (; end - p >= 32; p += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)p);
+        uint32_t hits = (uint32_t)_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(chunk, stx2_32), _mm256_cmpeq_epi8(chunk, stx1_32)));
+        if (hits) {
+            return p + __builtin_ctz(hits);
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i stx2 = _mm_set1_epi8((char)MAVLINK_STX);
+    const __m128i stx1 = _mm_set1_epi8((char)MAVLINK_STX_MAVLINK1);
+    for (; end - p >= 16; p += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        uint32_t hits = (uint32_t)_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(chunk, stx2), _mm_cmpeq_epi8(chunk, stx1)));
+        if (hits) {
+            return p + __builtin_ctz(hits);
+        }
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t stx2 = vdupq_n_u8(MAVLINK_STX);
+    const uint8x16_t stx1 = vdupq_n_u8(MAVLINK_STX_MAVLINK1);
+    for (; end - p >= 16; p += 16) {
+        uint8x16_t chunk = vld1q_u8(p);
+        uint8x16_t match = vorrq_u8(vceqq_u8(chunk, stx2), vceqq_u8(chunk, stx1));
+        // Narrowed to four bits per byte, NEON has no movemask
+        uint64_t hits = vget_lane_u64(vreinterpret_u64_u8(
+            vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0);
+        if (hits) {
+            return p + (__builtin_ctzll(hits) >> 2);
+        }
+    }
+#endif
+#endif
+    for (; p < end; p++) {
+        if (*p == MAVLINK_STX || *p == MAVLINK_STX_MAVLINK1) {
+            return p;
+        }
+    }
+    return end;
+}
+
+// Takes in as much of the payload of the frame in progress as buf holds,
+// like the state machine does byte by byte
+static void parse_payload(libmavlink_parser_t *parser, const uint8_t *buf, int length, int *pos) {
+    mavlink_message_t *rxmsg = &parser->rxmsg;
+    int n = rxmsg->len - parser->status.packet_idx;
+    uint16_t checksum = rxmsg->checksum;
+
+    if (n > length - *pos) {
+        n = length - *pos;
+    }
+    memcpy(_MAV_PAYLOAD_NON_CONST(rxmsg) + parser->status.packet_idx, buf + *pos, n);
+    libmavlink_crc_accumulate_buffer(&checksum, buf + *pos, n);
+    rxmsg->checksum = checksum;
+    parser->status.packet_idx += n;
+    *pos += n;
+    if (parser->status.packet_idx == rxmsg->len) {
+        parser->status.parse_state = MAVLINK_PARSE_STATE_GOT_PAYLOAD;
+    }
+}
+
+// Bulk form of libmavlink_parse_char over buf[*pos, length): returns once
+// a frame completed, *pos just past its last byte, or at the end of buf.
+// Between frames the state machine ignores everything but a start byte,
+// so the bytes up to the next one are skipped without going through it;
+// payloads are copied and checksummed in one go.
+uint8_t libmavlink_parse_buffer(libmavlink_parser_t *parser, const uint8_t *buf, int length,
+                                int *pos, mavlink_message_t *r_message, mavlink_status_t *r_status) {
+    while (*pos < length) {
+        if (parser->status.parse_state == MAVLINK_PARSE_STATE_GOT_MSGID3) {
+            parse_payload(parser, buf, length, pos);
+            continue;
+        }
+        // Back to back frames need no search
+        if (parser->status.parse_state <= MAVLINK_PARSE_STATE_IDLE &&
+            buf[*pos] != MAVLINK_STX && buf[*pos] != MAVLINK_STX_MAVLINK1) {
+            *pos = (int)(find_frame_start(buf + *pos, buf + length) - buf);
+            if (*pos == length) {
+                break;
+            }
+        }
+        uint8_t msg_received = libmavlink_parse_char(parser, buf[(*pos)++], r_message, r_status);
+        if (msg_received) {
+            return msg_received;
+        }
+    }
+    return MAVLINK_FRAMING_INCOMPLETE;
+}
@@ -1,7 +1,11 @@
+#ifndef __LIBMAVLINK_H__
+#define __LIBMAVLINK_H__
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <termios.h>
@@ -9,9 +13,45 @@
 #include <inttypes.h>
 #include <ctype.h>
 #include <pthread.h>
+#include <stdatomic.h>
+
 
+// The parser looks up message entries in libmavlink.c's direct-indexed
+// table instead of mavlink_helpers.h's bisection
+#include <../thirdparty/c_library_v1/mavlink_types.h>
+#define MAVLINK_GET_MSG_ENTRY
+const mavlink_msg_entry_t *mavlink_get_msg_entry(uint32_t msgid);
 
 #include <../thirdparty/c_library_v1/common/mavlink.h>
 #include <../thirdparty/c_library_v1/ardupilotmega/ardupilotmega.h>
 #include <../thirdparty/c_library_v1/common/mavlink_msg_rc_channels_override.h>
 
+
+
+// Running decoder counters; written by the decoding thread, read by probes
+typedef struct {
+    atomic_uint frames_ok;
+    atomic_uint crc_errors;
+    atomic_uint parse_errors; // every framing failure, bad CRCs included
+} libmavlink_parser_stats_t;
+
+// Caller-owned parser state. Each serial link gets its own so that bytes
+// from different ports never interleave in one decoder (unlike the static
+// per-channel buffers behind mavlink_parse_char).
+typedef struct {
+    mavlink_message_t rxmsg;
+    mavlink_status_t status;
+    libmavlink_parser_stats_t stats;
+} libmavlink_parser_t;
+
+void libmavlink_init(void);
+void libmavlink_parser_init(libmavlink_parser_t *parser);
+bool libmavlink_ardupilotmega_message(uint32_t msgid);
+void libmavlink_crc_accumulate_buffer(uint16_t *crc_accum, const uint8_t *buf, size_t length);
+void libmavlink_parser_resync(libmavlink_parser_t *parser);
+uint8_t libmavlink_parse_char(libmavlink_parser_t *parser, uint8_t c,
+                              mavlink_message_t *r_message, mavlink_status_t *r_status);
+uint8_t libmavlink_parse_buffer(libmavlink_parser_t *parser, const uint8_t *buf, int length,
+                                int *pos, mavlink_message_t *r_message, mavlink_status_t *r_status);
+
+#endif
@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ur-device-registry.h>
+
+#define SLOT_OF(id) ((id) & (DEVICE_MAX_SLOTS - 1))
+#define GENERATION_OF(id) (((uint32_t)(id) >> DEVICE_SLOT_BITS) & DEVICE_GENERATION_MASK)
+
+// FNV-1a
+static unsigned int path_bucket(const char *path) {
+    uint32_t hash = 2166136261u;
+    for (; *path; path++) {
+        hash ^= (uint8_t)*path;
+        hash *= 16777619u;
+    }
+    return hash % DEVICE_PATH_BUCKETS;
+}
+
+static DeviceSlot *slot_at(const DeviceRegistry *registry, int slot) {
+    DeviceSlot *chunk = atomic_load_explicit(&registry->chunks[slot / DEVICE_CHUNK_SLOTS],
+                                             memory_order_acquire);
+    return chunk ? &chunk[slot % DEVICE_CHUNK_SLOTS] : NULL;
+}
+
+void device_registry_init(DeviceRegistry *registry) {
+    for (int i = 0; i < DEVICE_CHUNKS; i++) {
+        atomic_init(&registry->chunks[i], NULL);
+    }
+    atomic_init(&registry->slot_count, 0);
+    registry->free_head = -1;
+    registry->live = 0;
+    memset(registry->buckets, 0, sizeof(registry->buckets));
+}
+
+// Gives dev a slot and an id, and makes it findable by dev->path
+bool device_registry_insert(DeviceRegistry *registry, DeviceInfo *dev) {
+    int slot = registry->free_head;
+    DeviceSlot *entry;
+
+    if (slot >= 0) {
+        entry = slot_at(registry, slot);
+        registry->free_head = entry->next_free;
+    } else {
+        slot = atomic_load_explicit(&registry->slot_count, memory_order_relaxed);
+        if (slot >= DEVICE_MAX_SLOTS) {
+            return false;
+        }
+        int chunk = slot / DEVICE_CHUNK_SLOTS;
+        if (!slot_at(registry, slot)) {
+            // calloc leaves the atomics zeroed, which is their initial state
+            DeviceSlot *fresh = calloc(DEVICE_CHUNK_SLOTS, sizeof(DeviceSlot));
+            if (!fresh) {
+                return false;
+            }
+            atomic_store_explicit(&registry->chunks[chunk], fresh, memory_order_release);
+        }
+        entry = slot_at(registry, slot);
+        atomic_store_explicit(&entry->generation, 1, memory_order_relaxed);
+        atomic_store_explicit(&registry->slot_count, slot + 1, memory_order_release);
+    }
+
+    entry->next_free = -1;
+    unsigned int generation = atomic_load_explicit(&entry->generation, memory_order_relaxed);
+    dev->id = (int)((generation << DEVICE_SLOT_BITS) | slot);
+    // Publishes dev, it must be fully set up by now
+    atomic_store_explicit(&entry->dev, dev, memory_order_release);
+
+    unsigned int bucket = path_bucket(dev->path);
+    dev->path_next = registry->buckets[bucket];
+    registry->buckets[bucket] = dev;
+    registry->live++;
+    return true;
+}
+
+DeviceInfo *device_registry_find_path(const DeviceRegistry *registry, const char *path) {
+    DeviceInfo *dev = registry->buckets[path_bucket(path)];
+    while (dev && strcmp(dev->path, path) != 0) {
+        dev = dev->path_next;
+    }
+    return dev;
+}
+
+// NULL for ids whose device has been removed since. Lock free, safe to
+// call while the owner inserts and removes: the generation is checked on
+// both sides of the load so a slot recycled in between is not mistaken for
+// the one asked about. The owner must not free a device while a lookup of
+// its id can still be under way; for ids that come from a cssl port,
+// closing the port first is enough.
+DeviceInfo *device_registry_find_id(const DeviceRegistry *registry, int id) {
+    if (id < 0 || SLOT_OF(id) >= atomic_load_explicit(&registry->slot_count, memory_order_acquire)) {
+        return NULL;
+    }
+    DeviceSlot *entry = slot_at(registry, SLOT_OF(id));
+    if (!entry) {
+        return NULL;
+    }
+    uint32_t generation = GENERATION_OF(id);
+    if (atomic_load_explicit(&entry->generation, memory_order_acquire) != generation) {
+        return NULL;
+    }
+    DeviceInfo *dev = atomic_load_explicit(&entry->dev, memory_order_acquire);
+    if (atomic_load_explicit(&entry->generation, memory_order_acquire) != generation) {
+        return NULL;
+    }
+    return dev;
+}
+
+// The path becomes free for a new device while dev itself stays resolvable
+// by id, e.g. until its probe has wound down
+void device_registry_unlink_path(DeviceRegistry *registry, DeviceInfo *dev) {
+    DeviceInfo **link = &registry->buckets[path_bucket(dev->path)];
+    while (*link) {
+        if (*link == dev) {
+            *link = dev->path_next;
+            dev->path_next = NULL;
+            return;
+        }
+        link = &(*link)->path_next;
+    }
+}
+
+// Frees dev's slot, its id goes stale. The caller owns dev's memory.
+void device_registry_remove(DeviceRegistry *registry, DeviceInfo *dev) {
+    int slot = SLOT_OF(dev->id);
+    DeviceSlot *entry = slot_at(registry, slot);
+
+    if (!entry || atomic_load_explicit(&entry->dev, memory_order_relaxed) != dev) {
+        return;
+    }
+    device_registry_unlink_path(registry, dev);
+    unsigned int generation = (atomic_load_explicit(&entry->generation, memory_order_relaxed) + 1)
+                              & DEVICE_GENERATION_MASK;
+    atomic_store_explicit(&entry->generation, generation ? generation : 1, memory_order_release);
+    atomic_store_explicit(&entry->dev, NULL, memory_order_release);
+    entry->next_free = registry->free_head;
+    registry->free_head = slot;
+    registry->live--;
+}
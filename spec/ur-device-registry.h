@@ -0,0 +1,43 @@
+#ifndef __UR_DEVICE_REGISTRY_H__
+#define __UR_DEVICE_REGISTRY_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <ur-discovery.h>
+
+// Device ids are (generation << DEVICE_SLOT_BITS) | slot. A slot's
+// generation moves on every time it is freed, so an id handed out for a
+// device that has since been removed never resolves to its successor.
+#define DEVICE_SLOT_BITS 12
+#define DEVICE_MAX_SLOTS (1 << DEVICE_SLOT_BITS)
+#define DEVICE_GENERATION_MASK 0x7ffff // keeps ids positive
+// Slots live in chunks allocated on first use and never moved
+#define DEVICE_CHUNK_SLOTS 64
+#define DEVICE_CHUNKS (DEVICE_MAX_SLOTS / DEVICE_CHUNK_SLOTS)
+#define DEVICE_PATH_BUCKETS 256
+
+typedef struct {
+    _Atomic(DeviceInfo *) dev;
+    atomic_uint generation;
+    int next_free; // free list, -1 terminates
+} DeviceSlot;
+
+// Writers are serialised by the owner. device_registry_find_id may run
+// concurrently with them, see there.
+typedef struct {
+    _Atomic(DeviceSlot *) chunks[DEVICE_CHUNKS];
+    atomic_int slot_count; // slots ever handed out
+    int free_head;
+    int live;
+    DeviceInfo *buckets[DEVICE_PATH_BUCKETS]; // by path, chained on path_next
+} DeviceRegistry;
+
+void device_registry_init(DeviceRegistry *registry);
+bool device_registry_insert(DeviceRegistry *registry, DeviceInfo *dev);
+DeviceInfo *device_registry_find_path(const DeviceRegistry *registry, const char *path);
+DeviceInfo *device_registry_find_id(const DeviceRegistry *registry, int id);
+void device_registry_unlink_path(DeviceRegistry *registry, DeviceInfo *dev);
+void device_registry_remove(DeviceRegistry *registry, DeviceInfo *dev);
+
+#endif
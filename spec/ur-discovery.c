@@ -1,8 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
 #include <unistd.h>
-#include <sys/inotify.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
 #include <libudev.h>
 #include <dirent.h>
 #include <stdbool.h>
@@ -12,30 +17,55 @@
 #include <cssl.h>
 #include <libmavlink.h>
 #include <ur-discovery.h>
+#include <ur-device-registry.h>
+#include <ur-identity-cache.h>
+#include <ur-event-outbox.h>
 
 #define MAVROUTER_ACTIONS_TOPIC "ur-mavrouter-actions"
 #define MAVROUTER_RESULTS_TOPIC "ur-mavrouter-results"
 #define MAVROUTER_FORWARDER_TOPIC "ur-linker-info"
 
+// Every device we know of, by path and by id. devices_mutex guards the
+// registry and the probing/removed handover between a probe and removal.
+static DeviceRegistry registry;
+static pthread_mutex_t devices_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t registry_once = PTHREAD_ONCE_INIT;
+
+static void registry_init(void) {
+    device_registry_init(&registry);
+}
+
+// The devices found by the startup scan and how long until the last of
+// them was probed, i.e. the time to a full inventory. Guarded by
+// devices_mutex.
+typedef struct {
+    bool scanning; // devices queued now are part of the startup set
+    bool reported;
+    uint64_t begin_ms;
+    int pending;   // startup probes not finished yet
+    int ports;
+    int routed;
+    uint64_t routed_ms; // last startup device handed to the router
+} StartupInventory;
+
+static StartupInventory startup;
+
+// Boards seen in their bootloader whose application port is due, guarded
+// by devices_mutex
+typedef struct {
+    UsbIdentity usb;
+    uint64_t until_ms;
+} BootWatch;
+
+static BootWatch boot_watches[MAX_BOOT_WATCHES];
+
 
 
 void register_device_mavrouter(char* dev_path){
-    DeviceState state = {
-        .dev_path = dev_path,
-        .enable =true
-    };
-    char* json ;
-    serialize_device_state(&state,json,MAVROUTER_ACTIONS_TOPIC);
-    free(json);
+    outbox_router_state(MAVROUTER_ACTIONS_TOPIC, dev_path, true);
 }
 void unregister_device_mavrouter(char* dev_path){
-    DeviceState state = {
-        .dev_path = dev_path,
-        .enable =false
-    };
-    char* json ;
-    serialize_device_state(&state,json,MAVROUTER_ACTIONS_TOPIC);
-    free(json);
+    outbox_router_state(MAVROUTER_ACTIONS_TOPIC, dev_path, false);
 }
 
 #ifdef _DevCollecterAdvanced
@@ -89,6 +119,184 @@ void unregister_device_mavrouter(char* dev_path){
     }
 #endif
 
+// Reads a "baud_rates" array into options, keeping what is there when absent
+static void parse_baud_rates(const cJSON *array, DeviceTemplateOptions *options) {
+    if (!cJSON_IsArray(array)) {
+        return;
+    }
+
+    int count = 0;
+    const cJSON *rate = NULL;
+    cJSON_ArrayForEach(rate, array) {
+        if (count >= MAX_BAUD_RATES) {
+            fprintf(stderr, "Warning: Too many baud rates, maximum is %d\n", MAX_BAUD_RATES);
+            break;
+        }
+        if (!cJSON_IsNumber(rate) || rate->valueint <= 0) {
+            fprintf(stderr, "Warning: Invalid value in baud_rates array\n");
+            continue;
+        }
+        options->baud_rates[count++] = rate->valueint;
+    }
+
+    if (count > 0) {
+        options->baud_count = count;
+    }
+}
+
+// Every prober discovery knows, config names pick from these
+static const Prober *const prober_table[] = {
+    &mavlink_prober,
+    &gnss_prober,
+    &bootloader_prober,
+};
+#define PROBER_COUNT ((int)(sizeof(prober_table) / sizeof(prober_table[0])))
+#define ALL_PROBERS ((1u << PROBER_COUNT) - 1)
+_Static_assert(PROBER_COUNT <= MAX_PROBERS, "prober_table outgrew MAX_PROBERS");
+
+// Reads a "probers" array of names into options, keeping what is there
+// when absent
+static void parse_probers(const cJSON *array, DeviceTemplateOptions *options) {
+    if (!cJSON_IsArray(array)) {
+        return;
+    }
+
+    uint32_t mask = 0;
+    const cJSON *name = NULL;
+    cJSON_ArrayForEach(name, array) {
+        int i = 0;
+        while (i < PROBER_COUNT &&
+               !(cJSON_IsString(name) && strcmp(name->valuestring, prober_table[i]->name) == 0)) {
+            i++;
+        }
+        if (i == PROBER_COUNT) {
+            fprintf(stderr, "Warning: Unknown prober in probers array\n");
+            continue;
+        }
+        mask |= 1u << i;
+    }
+
+    if (mask) {
+        options->probers = mask;
+    }
+}
+
+// Reads "probe_strategy" and "listen_ms" into options, keeping what is
+// there when absent
+static void parse_strategy(const cJSON *object, DeviceTemplateOptions *options) {
+    const cJSON *strategy = cJSON_GetObjectItemCaseSensitive(object, "probe_strategy");
+    if (cJSON_IsString(strategy)) {
+        if (strcmp(strategy->valuestring, "active") == 0) {
+            options->strategy = PROBE_STRATEGY_ACTIVE;
+        } else if (strcmp(strategy->valuestring, "listen_first") == 0) {
+            options->strategy = PROBE_STRATEGY_LISTEN_FIRST;
+        } else {
+            fprintf(stderr, "Warning: Unknown probe_strategy %s\n", strategy->valuestring);
+        }
+    }
+
+    const cJSON *listen = cJSON_GetObjectItemCaseSensitive(object, "listen_ms");
+    if (cJSON_IsNumber(listen)) {
+        if (listen->valueint >= MIN_LISTEN_MS) {
+            options->listen_ms = listen->valueint;
+        } else {
+            fprintf(stderr, "Warning: listen_ms must be at least %d\n", MIN_LISTEN_MS);
+        }
+    }
+}
+
+static bool add_predicate(TemplatePredicates *predicates, const char *property,
+                          const cJSON *value, bool lowercase) {
+    if (!cJSON_IsString(value)) {
+        fprintf(stderr, "Warning: Value of %s must be a string\n", *property ? property : "driver");
+        return false;
+    }
+    if (predicates->count >= MAX_TEMPLATE_PREDICATES || strlen(property) >= MAX_PROPERTY_LEN) {
+        fprintf(stderr, "Warning: Too many or too long udev conditions, maximum is %d\n",
+                MAX_TEMPLATE_PREDICATES);
+        return false;
+    }
+
+    // udev spells hex ids in lower case
+    char pattern[MAX_TEMPLATE_LEN];
+    snprintf(pattern, sizeof(pattern), "%s", value->valuestring);
+    for (char *c = pattern; lowercase && *c; c++) {
+        *c = tolower((unsigned char)*c);
+    }
+
+    TemplatePredicate *predicate = &predicates->items[predicates->count];
+    strcpy(predicate->property, property);
+    glob_set_init(&predicate->value);
+    if (!glob_set_add(&predicate->value, pattern, 0)) {
+        fprintf(stderr, "Warning: Invalid pattern '%s' for %s\n", pattern, *property ? property : "driver");
+        return false;
+    }
+    predicates->count++;
+    return true;
+}
+
+static void free_predicates(TemplatePredicates *predicates) {
+    for (int i = 0; i < predicates->count; i++) {
+        glob_set_free(&predicates->items[i].value);
+    }
+    predicates->count = 0;
+}
+
+// Either "ttyUSB*" or an object with a "pattern" and udev conditions:
+// "vid", "pid", "path" (ID_PATH), "driver" and "properties" for any other
+// udev property, every value a glob. Fills in the pattern and conditions;
+// false when the entry can't be used.
+static bool parse_template_entry(const cJSON *item, char pattern[MAX_TEMPLATE_LEN],
+                                 TemplatePredicates *predicates) {
+    const cJSON *name = item;
+    bool ok = true;
+
+    predicates->count = 0;
+    if (cJSON_IsObject(item)) {
+        name = cJSON_GetObjectItemCaseSensitive(item, "pattern");
+    }
+    if (!cJSON_IsString(name)) {
+        fprintf(stderr, "Warning: Template without a string pattern\n");
+        return false;
+    }
+    if (strlen(name->valuestring) >= MAX_TEMPLATE_LEN) {
+        fprintf(stderr, "Warning: Template too long, maximum is %d characters\n", MAX_TEMPLATE_LEN-1);
+        return false;
+    }
+    strcpy(pattern, name->valuestring);
+
+    if (cJSON_IsObject(item)) {
+        static const struct {
+            const char *key;
+            const char *property;
+            bool lowercase;
+        } shorthands[] = {
+            {"vid", "ID_VENDOR_ID", true},
+            {"pid", "ID_MODEL_ID", true},
+            {"path", "ID_PATH", false},
+            {"driver", "", false},
+        };
+        for (size_t i = 0; ok && i < sizeof(shorthands) / sizeof(shorthands[0]); i++) {
+            const cJSON *value = cJSON_GetObjectItemCaseSensitive(item, shorthands[i].key);
+            if (value) {
+                ok = add_predicate(predicates, shorthands[i].property, value, shorthands[i].lowercase);
+            }
+        }
+        const cJSON *property = NULL;
+        cJSON_ArrayForEach(property, cJSON_GetObjectItemCaseSensitive(item, "properties")) {
+            if (!ok) {
+                break;
+            }
+            ok = add_predicate(predicates, property->string, property, false);
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "Warning: Skipping template %s\n", pattern);
+        free_predicates(predicates);
+    }
+    return ok;
+}
+
 bool load_templates_from_json(const char *filename, DeviceTemplates *templates) {
     FILE *fp = fopen(filename, "r");
     if (!fp) {
@@ -118,7 +326,53 @@ bool load_templates_from_json(const char *filename, DeviceTemplates *templates)
         return false;
     }
 
+    // Top-level "baud_rates", "probers" and the strategy apply to
+    // templates that don't set their own
+    DeviceTemplateOptions defaults = {
+        .baud_rates = { DEFAULT_BAUD_RATE },
+        .baud_count = 1,
+        .probers = ALL_PROBERS,
+        .strategy = PROBE_STRATEGY_ACTIVE,
+        .listen_ms = DEFAULT_LISTEN_MS,
+    };
+    parse_baud_rates(cJSON_GetObjectItemCaseSensitive(root, "baud_rates"), &defaults);
+    parse_probers(cJSON_GetObjectItemCaseSensitive(root, "probers"), &defaults);
+    parse_strategy(root, &defaults);
+
+    templates->probe_concurrency = DEFAULT_PROBE_CONCURRENCY;
+    cJSON *concurrency = cJSON_GetObjectItemCaseSensitive(root, "probe_concurrency");
+    if (cJSON_IsNumber(concurrency)) {
+        if (concurrency->valueint >= 1 && concurrency->valueint <= MAX_PROBE_CONCURRENCY) {
+            templates->probe_concurrency = concurrency->valueint;
+        } else {
+            fprintf(stderr, "Warning: probe_concurrency must be 1..%d, using %d\n",
+                    MAX_PROBE_CONCURRENCY, DEFAULT_PROBE_CONCURRENCY);
+        }
+    }
+
+    templates->probes_in_flight = DEFAULT_PROBES_IN_FLIGHT;
+    cJSON *in_flight = cJSON_GetObjectItemCaseSensitive(root, "probes_in_flight");
+    if (cJSON_IsNumber(in_flight)) {
+        if (in_flight->valueint >= 1 && in_flight->valueint <= MAX_PROBES_IN_FLIGHT) {
+            templates->probes_in_flight = in_flight->valueint;
+        } else {
+            fprintf(stderr, "Warning: probes_in_flight must be 1..%d, using %d\n",
+                    MAX_PROBES_IN_FLIGHT, DEFAULT_PROBES_IN_FLIGHT);
+        }
+    }
+
+    // "" turns the identity cache off
+    strcpy(templates->identity_cache, DEFAULT_IDENTITY_CACHE_PATH);
+    cJSON *cache = cJSON_GetObjectItemCaseSensitive(root, "identity_cache");
+    if (cJSON_IsString(cache) && strlen(cache->valuestring) < DEV_PATH_LEN) {
+        strcpy(templates->identity_cache, cache->valuestring);
+    } else if (cache) {
+        fprintf(stderr, "Warning: identity_cache must be a path shorter than %d characters, using %s\n",
+                DEV_PATH_LEN, DEFAULT_IDENTITY_CACHE_PATH);
+    }
+
     templates->count = 0;
+    glob_set_init(&templates->allowed_set);
     cJSON *item = NULL;
     cJSON_ArrayForEach(item, allowed) {
         if (templates->count >= MAX_TEMPLATES) {
@@ -126,70 +380,181 @@ bool load_templates_from_json(const char *filename, DeviceTemplates *templates)
             break;
         }
 
-        if (!cJSON_IsString(item)) {
-            fprintf(stderr, "Warning: Non-string value in allowed_templates array\n");
+        // Either "ttyUSB*" or {"pattern": "ttyS1", "baud_rates": [921600, 57600], ...}
+        int index = templates->count;
+        if (!parse_template_entry(item, templates->templates[index], &templates->predicates[index])) {
             continue;
         }
-
-        const char *template = item->valuestring;
-        if (strlen(template) >= MAX_TEMPLATE_LEN) {
-            fprintf(stderr, "Warning: Template too long, maximum is %d characters\n", MAX_TEMPLATE_LEN-1);
+        if (!glob_set_add(&templates->allowed_set, templates->templates[index], index)) {
+            fprintf(stderr, "Warning: Invalid template %s\n", templates->templates[index]);
+            free_predicates(&templates->predicates[index]);
             continue;
         }
-
-        strncpy(templates->templates[templates->count], template, MAX_TEMPLATE_LEN-1);
-        templates->templates[templates->count][MAX_TEMPLATE_LEN-1] = '\0';
+        templates->options[index] = defaults;
+        templates->options[index].tuning = &templates->listen_tuning[index];
+        atomic_init(&templates->listen_tuning[index].samples, 0);
+        atomic_init(&templates->listen_tuning[index].longest_ms, 0);
+        if (cJSON_IsObject(item)) {
+            parse_baud_rates(cJSON_GetObjectItemCaseSensitive(item, "baud_rates"),
+                             &templates->options[index]);
+            parse_probers(cJSON_GetObjectItemCaseSensitive(item, "probers"),
+                          &templates->options[index]);
+            parse_strategy(item, &templates->options[index]);
+        }
         templates->count++;
     }
 
+    // Same syntax, a node matching any of these is never probed
+    templates->denied_count = 0;
+    glob_set_init(&templates->denied_set);
+    cJSON_ArrayForEach(item, cJSON_GetObjectItemCaseSensitive(root, "denied_templates")) {
+        if (templates->denied_count >= MAX_TEMPLATES) {
+            fprintf(stderr, "Warning: Too many denied templates, maximum is %d\n", MAX_TEMPLATES);
+            break;
+        }
+
+        int index = templates->denied_count;
+        if (!parse_template_entry(item, templates->denied[index], &templates->denied_predicates[index])) {
+            continue;
+        }
+        if (!glob_set_add(&templates->denied_set, templates->denied[index], index)) {
+            fprintf(stderr, "Warning: Invalid template %s\n", templates->denied[index]);
+            free_predicates(&templates->denied_predicates[index]);
+            continue;
+        }
+        templates->denied_count++;
+    }
+
     cJSON_Delete(root);
     return true;
 }
 
-bool is_monitored_device(const char *devname, const DeviceTemplates *templates) {
+void free_templates(DeviceTemplates *templates) {
     for (int i = 0; i < templates->count; i++) {
-        const char *pattern = templates->templates[i];
-        size_t pattern_len = strlen(pattern);
-        
-        if (pattern[pattern_len-1] == '*') {
-            if (strncmp(devname, pattern, pattern_len-1) == 0) {
-                return true;
-            }
-        } else {
-            if (strcmp(devname, pattern) == 0) {
-                return true;
-            }
+        free_predicates(&templates->predicates[i]);
+    }
+    for (int i = 0; i < templates->denied_count; i++) {
+        free_predicates(&templates->denied_predicates[i]);
+    }
+    glob_set_free(&templates->allowed_set);
+    glob_set_free(&templates->denied_set);
+    templates->count = templates->denied_count = 0;
+}
+
+// Drivers hang off the USB interface or platform device, not the tty
+static const char *device_driver(struct udev_device *device) {
+    for (; device; device = udev_device_get_parent(device)) {
+        const char *driver = udev_device_get_driver(device);
+        if (driver) {
+            return driver;
         }
     }
-    return false;
+    return NULL;
+}
+
+// Conditions can only hold for a device that has the properties
+static bool predicates_hold(const TemplatePredicates *predicates, struct udev_device *device) {
+    for (int i = 0; i < predicates->count; i++) {
+        const TemplatePredicate *predicate = &predicates->items[i];
+        const char *value = NULL;
+        if (device) {
+            value = predicate->property[0] ? udev_device_get_property_value(device, predicate->property)
+                                           : device_driver(device);
+        }
+        if (!value || !glob_set_match(&predicate->value, value)) {
+            return false;
+        }
+    }
+    return true;
 }
 
-void send_heartbeat_request(cssl_t *serial) {
+// Index of the first allowed template that matches devname and whose udev
+// conditions hold for device, or -1. All patterns are tried in one pass
+// over the name, the conditions only for the templates it matched.
+int match_device_template(const char *devname, struct udev_device *device, const DeviceTemplates *templates) {
+    uint64_t allowed = glob_set_match(&templates->allowed_set, devname);
+    if (!allowed) {
+        return -1;
+    }
+
+    uint64_t denied = glob_set_match(&templates->denied_set, devname);
+    for (; denied; denied &= denied - 1) {
+        if (predicates_hold(&templates->denied_predicates[__builtin_ctzll(denied)], device)) {
+            return -1;
+        }
+    }
+    for (; allowed; allowed &= allowed - 1) {
+        int index = __builtin_ctzll(allowed);
+        if (predicates_hold(&templates->predicates[index], device)) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+// Whether devname could be monitored by its name alone, a cheap filter
+// before looking at the device
+bool is_monitored_device(const char *devname, const DeviceTemplates *templates) {
+    return glob_set_match(&templates->allowed_set, devname) != 0;
+}
+
+// The pack helpers bump the sequence number in the shared MAVLINK_COMM_0
+// status, probe workers and the decoder pack concurrently
+static pthread_mutex_t mavlink_tx_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void handshake_append(MavlinkHandshake *handshake, const mavlink_message_t *msg) {
+    handshake->len += mavlink_msg_to_send_buffer(handshake->buf + handshake->len, msg);
+}
+
+static void handshake_request(MavlinkHandshake *handshake, uint8_t target_system,
+                              uint8_t target_component, uint16_t command, float param1) {
     mavlink_message_t msg;
-    uint8_t buf[MAVLINK_MAX_PACKET_LEN];
-    
-    mavlink_msg_heartbeat_pack(0, 0, &msg, 
-                              MAV_TYPE_GENERIC, 
-                              MAV_AUTOPILOT_INVALID, 
-                              0, 0, 0);
-    
-    uint16_t len = mavlink_msg_to_send_buffer(buf, &msg);
-    cssl_putdata(serial, buf, len);
+    mavlink_msg_command_long_pack(0, 0, &msg, target_system, target_component,
+                                  command, 0, param1, 0, 0, 0, 0, 0, 0);
+    handshake_append(handshake, &msg);
 }
 
-// Send request for autopilot version information
-void send_autopilot_version_request(cssl_t *serial) {
+// The whole probe in one go: a GCS heartbeat, which makes most autopilots
+// answer with theirs, and the AUTOPILOT_VERSION and PROTOCOL_VERSION
+// requests, so a device can be identified in a single round trip. Target
+// 0/0 broadcasts. With fallback the request is repeated as
+// MAV_CMD_REQUEST_AUTOPILOT_CAPABILITIES for firmware that predates
+// MAV_CMD_REQUEST_MESSAGE. mavlink1 frames it all with the 0xFE start
+// byte; PROTOCOL_VERSION can't be answered that way, asking costs nothing.
+void mavlink_handshake_encode(MavlinkHandshake *handshake, uint8_t target_system,
+                              uint8_t target_component, bool fallback, bool mavlink1) {
+    mavlink_status_t *tx_status = mavlink_get_channel_status(MAVLINK_COMM_0);
     mavlink_message_t msg;
-    uint8_t buf[MAVLINK_MAX_PACKET_LEN];
-    
-    mavlink_msg_command_long_pack(0, 0, &msg, 
-                                1, 1, // target system, component
-                                MAV_CMD_REQUEST_MESSAGE,
-                                0, // confirmation
-                                MAVLINK_MSG_ID_AUTOPILOT_VERSION,
-                                0, 0, 0, 0, 0, 0);
-    uint16_t len = mavlink_msg_to_send_buffer(buf, &msg);
-    cssl_putdata(serial, buf, len);
+
+    handshake->len = 0;
+    pthread_mutex_lock(&mavlink_tx_mutex);
+    if (mavlink1) {
+        tx_status->flags |= MAVLINK_STATUS_FLAG_OUT_MAVLINK1;
+    }
+    mavlink_msg_heartbeat_pack(0, 0, &msg,
+                               MAV_TYPE_GENERIC,
+                               MAV_AUTOPILOT_INVALID,
+                               0, 0, 0);
+    handshake_append(handshake, &msg);
+    handshake_request(handshake, target_system, target_component,
+                      MAV_CMD_REQUEST_MESSAGE, MAVLINK_MSG_ID_AUTOPILOT_VERSION);
+    handshake_request(handshake, target_system, target_component,
+                      MAV_CMD_REQUEST_MESSAGE, MAVLINK_MSG_ID_PROTOCOL_VERSION);
+    if (fallback) {
+        handshake_request(handshake, target_system, target_component,
+                          MAV_CMD_REQUEST_AUTOPILOT_CAPABILITIES, 1);
+    }
+    tx_status->flags &= ~MAVLINK_STATUS_FLAG_OUT_MAVLINK1;
+    pthread_mutex_unlock(&mavlink_tx_mutex);
+}
+
+const char *mavlink_dialect_name(MavlinkDialect dialect) {
+    switch (dialect) {
+        case MAVLINK_DIALECT_COMMON: return "common";
+        case MAVLINK_DIALECT_ARDUPILOTMEGA: return "ardupilotmega";
+        case MAVLINK_DIALECT_PX4: return "px4";
+        default: return "unknown";
+    }
 }
 
 
@@ -401,23 +766,29 @@ void process_autopilot_version(mavlink_message_t *msg, DeviceInfo *dev) {
     // Identify manufacturer and product
     identify_device(dev);
     
-    dev->info_collected = true;
     printf("PX4 device information collected from %s\n", dev->path);
 }
 
 #include <inttypes.h> 
 
-char* serialize_px4_device_info(const PX4DeviceInfo* info) {
-    if (!info) return NULL;
+// snprintf semantics: returns the length the record needs
+static int format_px4_device_info(char* buffer, size_t buf_size, const DeviceInfo* dev) {
+    const PX4DeviceInfo* info = &dev->px4_info;
 
-    // Calculate required buffer size (with margin for safety)
-    size_t buf_size = 512;  // Initial estimate
-    char* buffer = malloc(buf_size);
-    if (!buffer) return NULL;
-
-    // Format as JSON
-    int written = snprintf(buffer, buf_size,
+    return snprintf(buffer, buf_size,
         "{"
+        "\"dev_path\":\"%s\","
+        "\"baud\":%d,"
+        "\"sysid\":%u,"
+        "\"compid\":%u,"
+        "\"mavlink_version\":%u,"
+        "\"dialect\":\"%s\","
+        "\"protocol_version\":%u,"
+        "\"min_protocol_version\":%u,"
+        "\"max_protocol_version\":%u,"
+        "\"cached\":%s,"
+        "\"open_retries\":%d,"
+        "\"open_ms\":%ld,"
         "\"flight_sw_version\":%" PRIu64 ","
         "\"middleware_sw_version\":%" PRIu64 ","
         "\"os_sw_version\":%" PRIu64 ","
@@ -428,9 +799,21 @@ char* serialize_px4_device_info(const PX4DeviceInfo* info) {
         "\"middleware_custom_version\":\"%.8s\","
         "\"os_custom_version\":\"%.8s\","
         "\"uid\":\"%s\","
-        "\"product_name\":\"%s\","
-        "\"manufacturer\":\"%s\""
+        "\"product_name\":\"%.20s\","
+        "\"manufacturer\":\"%.20s\""
         "}",
+        dev->path,
+        dev->baud,
+        dev->sysid,
+        dev->compid,
+        dev->mavlink_version,
+        mavlink_dialect_name(dev->dialect),
+        dev->protocol_version,
+        dev->min_protocol_version,
+        dev->max_protocol_version,
+        dev->info_from_cache ? "true" : "false",
+        dev->open_retries,
+        dev->open_ms,
         info->flight_sw_version,
         info->middleware_sw_version,
         info->os_sw_version,
@@ -443,6 +826,18 @@ char* serialize_px4_device_info(const PX4DeviceInfo* info) {
         info->uid,
         info->product_name,
         info->manufacturer);
+}
+
+char* serialize_px4_device_info(const DeviceInfo* dev) {
+    if (!dev) return NULL;
+
+    // Calculate required buffer size (with margin for safety)
+    size_t buf_size = 512;  // Initial estimate
+    char* buffer = malloc(buf_size);
+    if (!buffer) return NULL;
+
+    // Format as JSON
+    int written = format_px4_device_info(buffer, buf_size, dev);
 
     // Handle buffer overflow
     if (written < 0) {
@@ -460,33 +855,7 @@ char* serialize_px4_device_info(const PX4DeviceInfo* info) {
         }
         buffer = new_buffer;
         
-        snprintf(buffer, buf_size,
-            "{"
-            "\"flight_sw_version\":%" PRIu64 ","
-            "\"middleware_sw_version\":%" PRIu64 ","
-            "\"os_sw_version\":%" PRIu64 ","
-            "\"board_version\":%" PRIu64 ","
-            "\"vendor_id\":%u,"
-            "\"product_id\":%u,"
-            "\"flight_custom_version\":\"%.8s\","
-            "\"middleware_custom_version\":\"%.8s\","
-            "\"os_custom_version\":\"%.8s\","
-            "\"uid\":\"%s\","
-            "\"product_name\":\"%.20s\","
-            "\"manufacturer\":\"%.20s\""
-            "}",
-            info->flight_sw_version,
-            info->middleware_sw_version,
-            info->os_sw_version,
-            info->board_version,
-            info->vendor_id,
-            info->product_id,
-            info->flight_custom_version,
-            info->middleware_custom_version,
-            info->os_custom_version,
-            info->uid,
-            info->product_name,
-            info->manufacturer);
+        format_px4_device_info(buffer, buf_size, dev);
     }
 
     return buffer;
@@ -497,6 +866,8 @@ void print_px4_device_info(DeviceInfo *dev) {
     printf("\nPX4 Device Information for %s:\n", dev->path);
     printf("  Manufacturer: %s\n", dev->px4_info.manufacturer);
     printf("  Product: %s\n", dev->px4_info.product_name);
+    printf("  Baud Rate: %d\n", dev->baud);
+    printf("  MAVLink: v%u, %s dialect\n", dev->mavlink_version, mavlink_dialect_name(dev->dialect));
     printf("  Flight SW Version: %llu\n", dev->px4_info.flight_sw_version);
     printf("  Middleware SW Version: %llu\n", dev->px4_info.middleware_sw_version);
     printf("  OS SW Version: %llu\n", dev->px4_info.os_sw_version);
@@ -509,253 +880,1007 @@ void print_px4_device_info(DeviceInfo *dev) {
     printf("  OS Custom Version: %.8s\n", dev->px4_info.os_custom_version);
 
     char* json = serialize_px4_device_info(dev);
-    publish_to_custom_topic(MAVROUTER_FORWARDER_TOPIC,json);
+    outbox_publish(MAVROUTER_FORWARDER_TOPIC,json);
     free(json);
 }
 
-// Updated mavlink_callback to handle additional messages
-void mavlink_callback(int id, uint8_t *buf, int length) {
+// Data callback of every probed port, on the cssl decoder thread. The
+// bytes go to each prober still in the running, and to the classifier
+// while nobody has claimed the port.
+void probe_data_callback(int id, uint8_t *buf, int length) {
     if (!(length > 0)) {
         printf("[+]Error while parsing String");
         return;
     }
 
-    mavlink_message_t msg;
-    mavlink_status_t status;
-    
-    for(int i = 0; i < length; i++) {
-        if (mavlink_parse_char(MAVLINK_COMM_0, buf[i], &msg, &status)) {
-            pthread_mutex_lock(&devices_mutex);
-            for (int j = 0; j < device_count; j++) {
-                if (devices[j].id == id) {
-                    switch(msg.msgid) {
-                        case MAVLINK_MSG_ID_HEARTBEAT:
-                            if (!devices[j].heartbeat_received) {
-                                devices[j].heartbeat_received = true;
-                                devices[j].mavlink_valid = true;
-                                printf("MAVLink heartbeat received from %s\n", devices[j].path);
-                                // register_device_mavrouter(devices[j].path);
-
-                                send_autopilot_version_request(devices[j].serial);
-                                devices[j].info_request_time = time(NULL);
-                            }
-                            break;
-                            
-                        case MAVLINK_MSG_ID_AUTOPILOT_VERSION:
-                            if (!devices[j].info_collected) {
-                                process_autopilot_version(&msg, &devices[j]);
-                                print_px4_device_info(&devices[j]);
-                            }
-                            break;
-                            
-                        default:
-                            // Handle other message types if needed
-                            break;
-                    }
-                    break;
+    // Lock free: the port is closed before its device is freed, so the
+    // entry found here stays valid for the whole callback. A stale id from
+    // a removed device resolves to nothing.
+    DeviceInfo *dev = device_registry_find_id(&registry, id);
+    if (!dev) {
+        return;
+    }
+
+    // A baud switch leaves half-decoded frames behind, start over
+    int baud = atomic_load(&dev->baud);
+    if (dev->parser_baud != baud) {
+        for (int i = 0; i < dev->prober_count; i++) {
+            if (dev->probers[i].prober->resync) {
+                dev->probers[i].prober->resync(dev);
+            }
+        }
+        stream_classifier_resync(&dev->classifier);
+        dev->parser_baud = baud;
+    }
+
+    // Statuses are written here only, probe_lock just hands a change over
+    // to the probe worker
+    int owner = atomic_load(&dev->owner);
+    bool kick = owner < 0;
+    for (int i = 0; i < dev->prober_count; i++) {
+        ProberSlot *slot = &dev->probers[i];
+        if ((owner >= 0 && i != owner) || slot->status == PROBER_IDENTIFIED) {
+            continue;
+        }
+        ProberStatus status = slot->prober->match(dev, buf, length);
+        if (status > slot->status) {
+            pthread_mutex_lock(&dev->probe_lock);
+            slot->status = status;
+            pthread_mutex_unlock(&dev->probe_lock);
+            kick = true;
+        }
+    }
+
+    // After the probers, so a worker that sees a foreign protocol counted
+    // also sees the prober that claimed it
+    if (owner < 0) {
+        stream_classifier_feed(&dev->classifier, buf, length);
+    }
+
+    // Until a prober claims the port new bytes may also settle the
+    // autobaud verdict, let the probe look
+    if (kick) {
+        probe_pool_kick(&dev->job);
+    }
+}
+
+// Sum of the uart framing/parity/break errors, false if the driver has none
+static bool read_line_errors(cssl_t *serial, unsigned long *errors) {
+    cssl_icount_t icount;
+    if (cssl_geticount(serial, &icount) < 0) {
+        return false;
+    }
+    *errors = icount.frame + icount.parity + icount.brk;
+    return true;
+}
+
+void autobaud_window_start(DeviceInfo *dev, AutobaudWindow *window) {
+    cssl_stats_t stats;
+    cssl_getstats(dev->serial, &stats);
+
+    window->frames_ok = atomic_load(&dev->parser.stats.frames_ok);
+    window->parse_errors = atomic_load(&dev->parser.stats.parse_errors);
+    window->crc_errors = atomic_load(&dev->parser.stats.crc_errors);
+    stream_classifier_snapshot(&dev->classifier, &window->stream);
+    window->rx_bytes = stats.rx_bytes;
+    window->has_line_errors = read_line_errors(dev->serial, &window->line_errors);
+}
+
+// Judges the current baud window. A wrong rate shows up quickly as bad CRCs,
+// framing errors or a stream of bytes that never forms a frame.
+AutobaudVerdict autobaud_check(DeviceInfo *dev, const AutobaudWindow *window, long elapsed_ms) {
+    // A checksummed frame of any protocol we know means the rate is right
+    StreamSnapshot stream;
+    stream_classifier_snapshot(&dev->classifier, &stream);
+    if (atomic_load(&dev->parser.stats.frames_ok) != window->frames_ok ||
+        stream.nmea != window->stream.nmea || stream.ubx != window->stream.ubx ||
+        stream.rtcm != window->stream.rtcm || stream.at != window->stream.at) {
+        return AUTOBAUD_LOCKED;
+    }
+    if (elapsed_ms < AUTOBAUD_MIN_DWELL_MS) {
+        return AUTOBAUD_WAIT;
+    }
+
+    if (atomic_load(&dev->parser.stats.parse_errors) - window->parse_errors >= AUTOBAUD_ERROR_THRESHOLD) {
+        return AUTOBAUD_SWITCH;
+    }
+
+    unsigned long line_errors;
+    if (window->has_line_errors && read_line_errors(dev->serial, &line_errors) &&
+        line_errors - window->line_errors >= AUTOBAUD_ERROR_THRESHOLD) {
+        return AUTOBAUD_SWITCH;
+    }
+
+    cssl_stats_t stats;
+    cssl_getstats(dev->serial, &stats);
+    if (stats.rx_bytes - window->rx_bytes >= AUTOBAUD_GARBAGE_BYTES) {
+        return AUTOBAUD_SWITCH;
+    }
+
+    return AUTOBAUD_WAIT;
+}
+
+// Open failures worth another try: the node is there but udev hasn't
+// finished with its permissions yet, or someone else holds it briefly
+static bool open_error_is_transient(int err) {
+    return err == EACCES || err == EPERM || err == EBUSY || err == ENOENT || err == ENXIO;
+}
+
+// Switches the open port to the next candidate rate and restarts the window
+static void probe_next_baud(DeviceInfo *dev, uint64_t now) {
+    dev->baud_index++;
+    atomic_store(&dev->baud, dev->options.baud_rates[dev->baud_index]);
+    cssl_setup(dev->serial, dev->baud, 8, 0, 1);
+    autobaud_window_start(dev, &dev->window);
+    dev->window_start_ms = now;
+    dev->next_request_ms = now;
+    printf("Probing %s at %d baud\n", dev->path, dev->baud);
+}
+
+// The listen_first window: the configured bound until the template has
+// seen enough devices speak up unasked, then half again the longest they
+// took
+static long listen_window_ms(const DeviceTemplateOptions *options) {
+    long window_ms = options->listen_ms;
+    if (options->tuning && atomic_load(&options->tuning->samples) >= LISTEN_TUNE_SAMPLES) {
+        long tuned_ms = atomic_load(&options->tuning->longest_ms) * 3L / 2;
+        if (tuned_ms < MIN_LISTEN_MS) {
+            tuned_ms = MIN_LISTEN_MS;
+        }
+        if (tuned_ms < window_ms) {
+            window_ms = tuned_ms;
+        }
+    }
+    return window_ms;
+}
+
+static void listen_tuning_observe(ListenTuning *tuning, long elapsed_ms) {
+    if (!tuning) {
+        return;
+    }
+    int longest = atomic_load(&tuning->longest_ms);
+    while (elapsed_ms > longest &&
+           !atomic_compare_exchange_weak(&tuning->longest_ms, &longest, (int)elapsed_ms)) {
+    }
+    atomic_fetch_add(&tuning->samples, 1);
+}
+
+// Candidate rates are tried in config order. A rate is left as soon as the
+// traffic proves undecodable, and kept for the full timeout once a valid
+// frame shows up. A silent line gets a bit over one heartbeat period per
+// rate when there are others left to try. With listen_first nothing is
+// sent and a silent line is not given up on until the listen window is
+// over; incoming traffic still walks the rates. Returns false when the
+// listening phase is over, otherwise arms the next wake-up.
+static bool probe_listen(DeviceInfo *dev, uint64_t now) {
+    while (1) {
+        if (dev->passive && now >= dev->listen_until_ms) {
+            printf("Nothing recognised on %s after %ld ms of listening, probing actively\n",
+                   dev->path, (long)(now - dev->listen_start_ms));
+            dev->passive = false;
+            autobaud_window_start(dev, &dev->window);
+            dev->window_start_ms = now;
+            dev->next_request_ms = now;
+        }
+
+        bool last_rate = (dev->baud_index == dev->options.baud_count - 1);
+        long elapsed_ms = (long)(now - dev->window_start_ms);
+
+        // Let the probers query the device periodically
+        if (!dev->passive && now >= dev->next_request_ms) {
+            for (int i = 0; i < dev->prober_count; i++) {
+                if (dev->probers[i].prober->poke) {
+                    dev->probers[i].prober->poke(dev, now);
                 }
             }
-            pthread_mutex_unlock(&devices_mutex);
+            dev->next_request_ms = now + HEARTBEAT_REQUEST_INTERVAL_MS;
+        }
+
+        // Checksummed frames of a protocol none of the probers claimed
+        // settle it whatever rates are left; so does a lot of noise at the
+        // last one
+        unsigned int frames = atomic_load(&dev->parser.stats.frames_ok) - dev->window.frames_ok;
+        StreamKind kind = stream_classify(&dev->classifier, &dev->window.stream, frames);
+        if (kind != STREAM_UNKNOWN && kind != STREAM_MAVLINK && (kind != STREAM_NOISE || last_rate)) {
+            dev->detected = kind;
+            return false;
+        }
+
+        if (!dev->baud_locked) {
+            AutobaudVerdict verdict = autobaud_check(dev, &dev->window, elapsed_ms);
+            if (verdict == AUTOBAUD_LOCKED) {
+                dev->baud_locked = true;
+                printf("Valid framing detected on %s at %d baud\n", dev->path, dev->baud);
+            } else if (verdict == AUTOBAUD_SWITCH && !last_rate) {
+                printf("Undecodable traffic on %s at %d baud, trying next rate\n", dev->path, dev->baud);
+                probe_next_baud(dev, now);
+                continue;
+            }
+        }
+
+        long window_ms = (dev->baud_locked || last_rate) ? MAVLINK_TIMEOUT_MS : AUTOBAUD_SILENT_WINDOW_MS;
+        uint64_t window_end = dev->window_start_ms + window_ms;
+        if (dev->passive && window_end < dev->listen_until_ms) {
+            window_end = dev->listen_until_ms;
+        }
+        if (now >= window_end) {
+            if (dev->baud_locked || last_rate) {
+                return false;
+            }
+            probe_next_baud(dev, now);
+            continue;
         }
+
+        // Wake for whichever comes first: next request or the end of
+        // listening, end of the autobaud dwell, end of the window. Incoming
+        // data kicks us earlier.
+        uint64_t wake = dev->passive ? dev->listen_until_ms : dev->next_request_ms;
+        if (window_end < wake) {
+            wake = window_end;
+        }
+        uint64_t dwell_end = dev->window_start_ms + AUTOBAUD_MIN_DWELL_MS;
+        if (!dev->baud_locked && now < dwell_end && dwell_end < wake) {
+            wake = dwell_end;
+        }
+        probe_pool_arm(&dev->job, wake);
+        return true;
     }
 }
 
-// Updated check_mavlink_device to include info collection timeout
-void* check_mavlink_device(void *arg) {
-    DeviceInfo *dev = (DeviceInfo *)arg;
-    struct timespec start, now, last_request;
-    bool timeout = false;
-    bool first_request = true;
-    bool info_timeout = false;
+// Tells what a port carries that none of its probers recognised, e.g. to
+// spot a GNSS receiver or modem that matched a template
+static void report_rejected(DeviceInfo *dev, uint64_t now) {
+    StreamSnapshot stream;
+    stream_classifier_snapshot(&dev->classifier, &stream);
+    unsigned int bytes = stream.bytes - dev->window.stream.bytes;
+    unsigned int stx = stream.stx - dev->window.stream.stx;
+    unsigned int crc_errors = atomic_load(&dev->parser.stats.crc_errors) - dev->window.crc_errors;
+    long elapsed_ms = (long)(now - dev->first_open_ms);
+    char json[512];
 
-    clock_gettime(CLOCK_MONOTONIC, &start);
-    clock_gettime(CLOCK_MONOTONIC, &last_request);
-    
-    printf("Starting MAVLink check for %s (ID: %d)\n", dev->path, dev->id);
-    
-    cssl_start();
-    dev->serial = cssl_open(dev->path, mavlink_callback, dev->id, 115200, 8, 0, 1);
-    
-    if (!dev->serial) {
-        fprintf(stderr, "Failed to open serial port %s\n", dev->path);
-        dev->thread_running = false;
-        return NULL;
+    printf("Device %s not recognised: %s at %d baud after %ld ms "
+           "(%u bytes, %u MAVLink start bytes, %u bad CRCs)\n",
+           dev->path, stream_kind_name(dev->detected), dev->baud, elapsed_ms, bytes, stx, crc_errors);
+
+    snprintf(json, sizeof(json),
+             "{\"event\":\"rejected\",\"dev_path\":\"%s\",\"detected\":\"%s\",\"baud\":%d,"
+             "\"elapsed_ms\":%ld,\"bytes\":%u,\"stx\":%u,\"crc_errors\":%u}",
+             dev->path, stream_kind_name(dev->detected), dev->baud, elapsed_ms, bytes, stx, crc_errors);
+    outbox_publish(DISCOVERY_STATUS_TOPIC, json);
+}
+
+// A cached route announced before the probe turned out not to hold
+static void withdraw_cached_route(DeviceInfo *dev) {
+    if (dev->registered) {
+        printf("Cached identity of %s withdrawn\n", dev->path);
+        unregister_device_mavrouter(dev->path);
+        identity_cache_forget(&dev->usb);
+        dev->registered = false;
     }
-    
-    while (!timeout && !dev->mavlink_valid) {
-        clock_gettime(CLOCK_MONOTONIC, &now);
-        long elapsed_ms = (now.tv_sec - start.tv_sec) * 1000 + 
-                         (now.tv_nsec - start.tv_nsec) / 1000000;
-        
-        // Send heartbeat request periodically
-        long since_last_request = (now.tv_sec - last_request.tv_sec) * 1000 +
-                                 (now.tv_nsec - last_request.tv_nsec) / 1000000;
-        
-        if (first_request || since_last_request >= HEARTBEAT_REQUEST_INTERVAL_MS) {
-            send_heartbeat_request(dev->serial);
-            clock_gettime(CLOCK_MONOTONIC, &last_request);
-            first_request = false;
+}
+
+// Index of the first prober that recognised the port, -1 if none yet
+static int detected_prober(DeviceInfo *dev) {
+    int detected = -1;
+    pthread_mutex_lock(&dev->probe_lock);
+    for (int i = 0; i < dev->prober_count && detected < 0; i++) {
+        if (dev->probers[i].status >= PROBER_DETECTED) {
+            detected = i;
         }
-        
-        if (elapsed_ms >= MAVLINK_TIMEOUT_MS) {
-            timeout = true;
+    }
+    pthread_mutex_unlock(&dev->probe_lock);
+    return detected;
+}
+
+// One scheduling round of a device probe, run on a pool worker whenever the
+// decoder kicks the job or its deadline expires
+static void probe_step(ProbeJob *job) {
+    DeviceInfo *dev = (DeviceInfo *)((char *)job - offsetof(DeviceInfo, job));
+    uint64_t now = probe_now_ms();
+    const Prober *expired = NULL;
+
+    if (atomic_load(&dev->removed) && dev->probe_state != PROBE_FINISHED) {
+        printf("Device %s removed, abandoning probe\n", dev->path);
+        dev->probe_state = PROBE_FINISHED;
+    }
+
+    if (dev->probe_state == PROBE_OPENING && dev->open_retries == 0) {
+        dev->baud_index = 0;
+        dev->baud_locked = false;
+        dev->baud = dev->options.baud_rates[0];
+        dev->first_open_ms = now;
+        printf("Starting device check for %s (ID: %d), probers:", dev->path, dev->id);
+        for (int i = 0; i < dev->prober_count; i++) {
+            printf(" %s", dev->probers[i].prober->name);
+        }
+        printf("\n");
+        // No decoder runs for the port yet, the statuses can be set here
+        for (int i = 0; i < dev->prober_count; i++) {
+            ProberSlot *slot = &dev->probers[i];
+            if (slot->prober->start) {
+                ProberStatus status = slot->prober->start(dev, now);
+                if (status > slot->status) {
+                    slot->status = status;
+                }
+            }
+        }
+        if (detected_prober(dev) >= 0) {
+            printf("Device %s recognised without opening it\n", dev->path);
+            dev->probe_state = PROBE_LISTENING;
         }
-        usleep(10000); // 10ms sleep
     }
 
-    // If we found a MAVLink device, wait for info collection
-    if (dev->mavlink_valid) {
-        printf("Device %s is MAVLink compatible - collecting info...\n", dev->path);
-        register_device_mavrouter(dev->path);
-        time_t info_start = time(NULL);
-        
-        while (!info_timeout && !dev->info_collected) {
-            time_t current = time(NULL);
-            if (difftime(current, info_start) > (INFO_COLLECTION_TIMEOUT_MS / 1000.0)) {
-                info_timeout = true;
-                printf("Timeout waiting for device info from %s\n", dev->path);
+    if (dev->probe_state == PROBE_OPENING) {
+        dev->serial = cssl_open(dev->path, probe_data_callback, dev->id, dev->baud, 8, 0, 1);
+        if (!dev->serial) {
+            int err = errno;
+            long waited_ms = (long)(now - dev->first_open_ms);
+            if (cssl_geterror() == CSSL_ERROR_OPEN && open_error_is_transient(err) &&
+                waited_ms < OPEN_RETRY_BUDGET_MS) {
+                int shift = dev->open_retries < 6 ? dev->open_retries : 6;
+                long delay_ms = (long)OPEN_RETRY_INITIAL_MS << shift;
+                if (delay_ms > OPEN_RETRY_MAX_DELAY_MS) {
+                    delay_ms = OPEN_RETRY_MAX_DELAY_MS;
+                }
+                dev->open_retries++;
+                printf("Cannot open %s yet (%s), retry %d in %ld ms\n",
+                       dev->path, strerror(err), dev->open_retries, delay_ms);
+                probe_pool_arm(job, now + delay_ms);
+                return;
             }
-            usleep(100000); // 100ms sleep
+            fprintf(stderr, "Failed to open serial port %s: %s (%s) after %d retries\n",
+                    dev->path, cssl_geterrormsg(), strerror(err), dev->open_retries);
+            withdraw_cached_route(dev);
+            probe_pool_done(job);
+            return;
+        }
+        dev->open_ms = (long)(now - dev->first_open_ms);
+        if (dev->open_retries) {
+            printf("Opened %s after %d retries, %ld ms\n", dev->path, dev->open_retries, dev->open_ms);
+        }
+        autobaud_window_start(dev, &dev->window);
+        dev->window_start_ms = now;
+        dev->next_request_ms = now;
+        dev->probe_state = PROBE_LISTENING;
+        printf("Probing %s at %d baud\n", dev->path, dev->baud);
+        dev->passive = dev->options.strategy == PROBE_STRATEGY_LISTEN_FIRST;
+        if (dev->passive) {
+            long window_ms = listen_window_ms(&dev->options);
+            dev->listen_start_ms = now;
+            dev->listen_until_ms = now + window_ms;
+            printf("Listening on %s for up to %ld ms before transmitting\n", dev->path, window_ms);
         }
-    } else {
-        printf("Device %s is not MAVLink compatible (timeout)\n", dev->path);
     }
 
-    cssl_close(dev->serial);
-    cssl_stop();
-    dev->thread_running = false;
-    
-    return NULL;
+    if (dev->probe_state == PROBE_LISTENING) {
+        int detected = detected_prober(dev);
+        if (detected < 0 && probe_listen(dev, now)) {
+            return;
+        }
+        if (detected < 0) {
+            // Claimed while the window was being judged
+            detected = detected_prober(dev);
+        }
+        if (detected >= 0 && dev->passive) {
+            long elapsed_ms = (long)(now - dev->listen_start_ms);
+            printf("Device %s recognised after %ld ms without transmitting\n", dev->path, elapsed_ms);
+            listen_tuning_observe(dev->options.tuning, elapsed_ms);
+            dev->passive = false;
+        }
+        if (detected >= 0) {
+            // The owner alone is fed from here on
+            const Prober *prober = dev->probers[detected].prober;
+            atomic_store(&dev->owner, detected);
+            if (prober->detected) {
+                prober->detected(dev, now);
+            }
+            dev->info_deadline_ms = now + prober->collect_timeout_ms;
+            dev->next_request_ms = now;
+            dev->probe_state = PROBE_COLLECTING;
+        } else {
+            if (dev->detected != STREAM_UNKNOWN) {
+                report_rejected(dev, now);
+            } else {
+                printf("Device %s not recognised (timeout)\n", dev->path);
+            }
+            withdraw_cached_route(dev);
+            dev->probe_state = PROBE_FINISHED;
+        }
+    }
+
+    if (dev->probe_state == PROBE_COLLECTING) {
+        ProberSlot *slot = &dev->probers[atomic_load(&dev->owner)];
+        pthread_mutex_lock(&dev->probe_lock);
+        bool identified = slot->status == PROBER_IDENTIFIED;
+        pthread_mutex_unlock(&dev->probe_lock);
+
+        if (!identified && now < dev->info_deadline_ms) {
+            uint64_t wake = dev->info_deadline_ms;
+            if (slot->prober->retry && dev->serial) {
+                if (now >= dev->next_request_ms) {
+                    dev->next_request_ms = slot->prober->retry(dev, now);
+                }
+                if (dev->next_request_ms < wake) {
+                    wake = dev->next_request_ms;
+                }
+            }
+            probe_pool_arm(job, wake);
+            return;
+        }
+        if (!identified && slot->prober->expired) {
+            expired = slot->prober;
+        } else if (!identified) {
+            printf("Timeout waiting for %s device info from %s\n", slot->prober->name, dev->path);
+        } else if (slot->prober->publish) {
+            slot->prober->publish(dev);
+        }
+        dev->probe_state = PROBE_FINISHED;
+    }
+
+    if (dev->serial) {
+        cssl_stats_t stats;
+        cssl_getstats(dev->serial, &stats);
+        printf("Port %s: %lu bytes received, ring high-water %lu, %lu bytes dropped\n",
+               dev->path, stats.rx_bytes, stats.ring_high_water, stats.overflow_drops);
+
+        // Only this port goes, the cssl reactor keeps serving the others
+        cssl_close(dev->serial);
+        dev->serial = NULL;
+    }
+    // After the close, the decoder is done writing what the prober reads
+    if (expired) {
+        expired->expired(dev);
+    }
+    // The port is gone, drop any half-decoded frame with it
+    for (int i = 0; i < dev->prober_count; i++) {
+        if (dev->probers[i].prober->resync) {
+            dev->probers[i].prober->resync(dev);
+        }
+    }
+    stream_classifier_init(&dev->classifier);
+    probe_pool_done(job);
+}
+
+static void free_device(DeviceInfo *dev) {
+    pthread_mutex_destroy(&dev->probe_lock);
+    free(dev);
 }
 
-WEAK void start_mavlink_check(const char *devpath) {
+static void report_inventory(const StartupInventory *inventory) {
+    uint64_t elapsed_ms = probe_now_ms() - inventory->begin_ms;
+    long routed_ms = inventory->routed ? (long)(inventory->routed_ms - inventory->begin_ms) : -1;
+    char json[160];
+
+    printf("Full inventory after %llu ms: %d ports probed, %d routed",
+           (unsigned long long)elapsed_ms, inventory->ports, inventory->routed);
+    if (inventory->routed) {
+        printf(", the last one after %ld ms", routed_ms);
+    }
+    printf("\n");
+
+    snprintf(json, sizeof(json),
+             "{\"event\":\"inventory\",\"elapsed_ms\":%llu,\"ports\":%d,\"routed\":%d,\"routed_ms\":%ld}",
+             (unsigned long long)elapsed_ms, inventory->ports, inventory->routed, routed_ms);
+    outbox_publish(DISCOVERY_STATUS_TOPIC, json);
+}
+
+// Called with devices_mutex held. True once the scan is over and every
+// device it found is done, then inventory holds what to report.
+static bool startup_inventory_complete(StartupInventory *inventory) {
+    if (startup.scanning || startup.pending || startup.reported) {
+        return false;
+    }
+    startup.reported = true;
+    *inventory = startup;
+    return true;
+}
+
+// The pool is done with the job. A device removed meanwhile is freed here,
+// its port is closed so no callback can still be looking at it.
+static void probe_finished(ProbeJob *job) {
+    DeviceInfo *dev = (DeviceInfo *)((char *)job - offsetof(DeviceInfo, job));
+    StartupInventory inventory;
+    bool complete = false;
+
     pthread_mutex_lock(&devices_mutex);
-    
-    if (device_count >= MAX_DEVICES) {
-        fprintf(stderr, "Maximum device count reached, cannot monitor %s\n", devpath);
+    dev->probing = false;
+    if (dev->startup) {
+        dev->startup = false;
+        startup.pending--;
+        if (dev->registered) {
+            startup.routed++;
+            if (dev->registered_ms > startup.routed_ms) {
+                startup.routed_ms = dev->registered_ms;
+            }
+        }
+        complete = startup_inventory_complete(&inventory);
+    }
+    bool removed = atomic_load(&dev->removed);
+    if (removed) {
+        device_registry_remove(&registry, dev);
+    }
+    pthread_mutex_unlock(&devices_mutex);
+
+    if (removed) {
+        free_device(dev);
+    }
+    if (complete) {
+        report_inventory(&inventory);
+    }
+}
+
+// Brings up the shared cssl reactor and the probe workers, once
+bool start_probe_pool(const DeviceTemplates *templates) {
+    cssl_start();
+    if (cssl_geterror()) {
+        fprintf(stderr, "Failed to start serial reactor: %s\n", cssl_geterrormsg());
+        return false;
+    }
+    // Without the cache devices are just probed from scratch
+    if (templates->identity_cache[0]) {
+        identity_cache_open(templates->identity_cache);
+    }
+    return probe_pool_start(templates->probe_concurrency, templates->probes_in_flight);
+}
+
+// A probe found a board in its bootloader: the port it comes back on in
+// application mode goes to the front of the probe queue
+void expect_application_port(const UsbIdentity *usb) {
+    uint64_t now = probe_now_ms();
+    BootWatch *watch = &boot_watches[0];
+
+    pthread_mutex_lock(&devices_mutex);
+    for (int i = 0; i < MAX_BOOT_WATCHES; i++) {
+        if (boot_watches[i].until_ms < watch->until_ms) {
+            watch = &boot_watches[i];
+        }
+    }
+    watch->usb = *usb;
+    watch->until_ms = now + BOOT_WATCH_MS;
+    pthread_mutex_unlock(&devices_mutex);
+}
+
+// Called with devices_mutex held. True, and the watch is done, when usb is
+// a board that was just seen in its bootloader.
+static bool take_boot_watch(const UsbIdentity *usb) {
+    uint64_t now = probe_now_ms();
+
+    for (int i = 0; i < MAX_BOOT_WATCHES; i++) {
+        BootWatch *watch = &boot_watches[i];
+        if (watch->until_ms <= now) {
+            continue;
+        }
+        if ((usb->serial[0] && strcmp(usb->serial, watch->usb.serial) == 0) ||
+            (usb->port[0] && strcmp(usb->port, watch->usb.port) == 0)) {
+            watch->until_ms = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Tries the rate the device answered at last time first
+static void prefer_baud(DeviceTemplateOptions *options, int baud) {
+    int i = 0;
+    while (i < options->baud_count && options->baud_rates[i] != baud) {
+        i++;
+    }
+    if (i == options->baud_count) {
+        if (options->baud_count < MAX_BAUD_RATES) {
+            options->baud_count++;
+        } else {
+            i = options->baud_count - 1;
+        }
+    }
+    memmove(&options->baud_rates[1], &options->baud_rates[0], i * sizeof(options->baud_rates[0]));
+    options->baud_rates[0] = baud;
+}
+
+WEAK void start_mavlink_check(const char *devpath, const DeviceTemplateOptions *options,
+                              const UsbIdentity *usb, ProbePriority priority) {
+    pthread_once(&registry_once, registry_init);
+    pthread_mutex_lock(&devices_mutex);
+
+    // Check if device is already being monitored
+    if (device_registry_find_path(&registry, devpath)) {
         pthread_mutex_unlock(&devices_mutex);
         return;
     }
 
-    // Check if device is already being monitored
-    for (int i = 0; i < device_count; i++) {
-        if (strcmp(devices[i].path, devpath) == 0) {
-            pthread_mutex_unlock(&devices_mutex);
-            return;
+    // Add new device
+    DeviceInfo *dev = calloc(1, sizeof(DeviceInfo));
+    if (!dev) {
+        fprintf(stderr, "Out of memory, cannot monitor %s\n", devpath);
+        pthread_mutex_unlock(&devices_mutex);
+        return;
+    }
+    strncpy(dev->path, devpath, DEV_PATH_LEN - 1);
+    dev->probing = true;
+    atomic_init(&dev->removed, false);
+    dev->options = *options;
+    if (usb) {
+        dev->usb = *usb;
+    }
+    dev->cache_hit = identity_cache_lookup(&dev->usb, &dev->cached);
+    if (dev->cache_hit) {
+        prefer_baud(&dev->options, dev->cached.baud);
+    }
+    atomic_init(&dev->baud, dev->options.baud_rates[0]);
+    for (int i = 0; i < PROBER_COUNT; i++) {
+        if ((dev->options.probers & (1u << i)) &&
+            (!prober_table[i]->applies || prober_table[i]->applies(dev))) {
+            dev->probers[dev->prober_count++].prober = prober_table[i];
         }
     }
+    if (dev->prober_count == 0) {
+        printf("No prober applies to %s, not probing it\n", devpath);
+        pthread_mutex_unlock(&devices_mutex);
+        free(dev);
+        return;
+    }
+    atomic_init(&dev->owner, -1);
+    dev->probe_state = PROBE_OPENING;
+    libmavlink_parser_init(&dev->parser);
+    pthread_mutex_init(&dev->probe_lock, NULL);
+    // Lookups by id see the entry from here on
+    if (!device_registry_insert(&registry, dev)) {
+        fprintf(stderr, "Maximum device count reached, cannot monitor %s\n", devpath);
+        pthread_mutex_unlock(&devices_mutex);
+        pthread_mutex_destroy(&dev->probe_lock);
+        free(dev);
+        return;
+    }
 
-    // Add new device
-    strncpy(devices[device_count].path, devpath, DEV_PATH_LEN);
-    devices[device_count].mavlink_valid = false;
-    devices[device_count].thread_running = true;
-    devices[device_count].serial = NULL;
-    devices[device_count].id = device_count;
-    devices[device_count].heartbeat_received = false;
-
-    if (pthread_create(&devices[device_count].thread, NULL, check_mavlink_device, &devices[device_count]) != 0) {
-        fprintf(stderr, "Failed to create thread for device %s\n", devpath);
-        devices[device_count].thread_running = false;
-    } else {
-        printf("Started MAVLink check thread for %s (ID: %d)\n", devpath, device_count);
-        device_count++;
+    if (usb && take_boot_watch(usb)) {
+        printf("%s is back from its bootloader, fast-tracking its probe\n", devpath);
+        priority = PROBE_PRIORITY_HIGH;
+    }
+    if (startup.scanning) {
+        dev->startup = true;
+        startup.pending++;
+        startup.ports++;
     }
+    probe_pool_submit(&dev->job, probe_step, probe_finished, priority);
+    printf("Queued device check for %s (ID: %d)\n", devpath, dev->id);
 
     pthread_mutex_unlock(&devices_mutex);
 }
 
-void print_device_info(const char *devname) {
-    char devpath[DEV_PATH_LEN];
-    snprintf(devpath, sizeof(devpath), "/dev/%s", devname);
+// Forgets a /dev node that went away and frees its registry slot. A probe
+// still in flight is told to stop and the entry goes once it has.
+// Returns whether devpath was known
+bool remove_device(const char *devpath) {
+    pthread_once(&registry_once, registry_init);
+    pthread_mutex_lock(&devices_mutex);
 
-    struct udev *udev;
-    struct udev_device *dev;
-    
-    udev = udev_new();
-    if (!udev) {
-        fprintf(stderr, "Can't create udev\n");
-        return;
+    DeviceInfo *dev = device_registry_find_path(&registry, devpath);
+    if (!dev) {
+        pthread_mutex_unlock(&devices_mutex);
+        return false;
     }
-    
-    dev = udev_device_new_from_subsystem_sysname(udev, "tty", devname);
-    
-    if (dev) {
-        printf("Device Path: %s\n", devpath);
-        printf("Device Name: %s\n", devname);
-        
-        struct udev_device *parent = udev_device_get_parent_with_subsystem_devtype(
-            dev, "usb", "usb_device");
-        if (parent) {
-            printf("  VID/PID: %s %s\n",
-                   udev_device_get_sysattr_value(parent, "idVendor"),
-                   udev_device_get_sysattr_value(parent, "idProduct"));
-            printf("  Manufacturer: %s\n",
-                   udev_device_get_sysattr_value(parent, "manufacturer"));
-            printf("  Product: %s\n",
-                   udev_device_get_sysattr_value(parent, "product"));
-            printf("  Serial: %s\n",
-                   udev_device_get_sysattr_value(parent, "serial"));
+
+    // The path is free for the next plug-in right away
+    device_registry_unlink_path(&registry, dev);
+    atomic_store(&dev->removed, true);
+    bool probing = dev->probing;
+    if (probing) {
+        probe_pool_kick(&dev->job);
+    } else {
+        device_registry_remove(&registry, dev);
+    }
+    pthread_mutex_unlock(&devices_mutex);
+
+    if (!probing) {
+        free_device(dev);
+    }
+    return true;
+}
+
+// One udev context for the whole process, used from the main thread only
+static struct udev *udev_ctx = NULL;
+
+static struct udev *discovery_udev(void) {
+    if (!udev_ctx) {
+        udev_ctx = udev_new();
+        if (!udev_ctx) {
+            fprintf(stderr, "Can't create udev\n");
         }
+    }
+    return udev_ctx;
+}
+
+// USB serial adapters and CDC ACM boards carry the ID_* properties set by
+// udev's usb_id builtin, so nothing has to be looked up again here
+void print_device_info(struct udev_device *device) {
+    const char *devnode = udev_device_get_devnode(device);
+    const char *devname = udev_device_get_sysname(device);
+    const char *vid = udev_device_get_property_value(device, "ID_VENDOR_ID");
+
+    printf("Device Path: %s\n", devnode);
+    if (vid) {
+        printf("Device Name: %s\n", devname);
+        printf("  VID/PID: %s %s\n", vid,
+               udev_device_get_property_value(device, "ID_MODEL_ID"));
+        printf("  Manufacturer: %s\n",
+               udev_device_get_property_value(device, "ID_VENDOR"));
+        printf("  Product: %s\n",
+               udev_device_get_property_value(device, "ID_MODEL"));
+        printf("  Serial: %s\n",
+               udev_device_get_property_value(device, "ID_SERIAL_SHORT"));
         #ifdef _DevCollecterAdvanced
         DeviceInfoTransport info = {
-            .dev_path = devpath,
+            .dev_path = devnode,
             .dev_name = devname,
-            .vid = udev_device_get_sysattr_value(parent, "idVendor"),
-            .pid = udev_device_get_sysattr_value(parent, "idProduct"),
-            .manufacturer = udev_device_get_sysattr_value(parent, "manufacturer"),
-            .product = udev_device_get_sysattr_value(parent, "product"),
-            .serial = udev_device_get_sysattr_value(parent, "serial"),
+            .vid = vid,
+            .pid = udev_device_get_property_value(device, "ID_MODEL_ID"),
+            .manufacturer = udev_device_get_property_value(device, "ID_VENDOR"),
+            .product = udev_device_get_property_value(device, "ID_MODEL"),
+            .serial = udev_device_get_property_value(device, "ID_SERIAL_SHORT"),
             .usb_info_available = true
         };
         #endif
-        
-        udev_device_unref(dev);
     } else {
-        printf("Device Path: %s\n", devpath);
         printf("Device Name: %s (no additional info available)\n", devname);
     }
+}
 
-    udev_unref(udev);
+// Key of the identity cache plus the bus position, left empty for
+// anything that isn't USB
+static void read_usb_identity(struct udev_device *device, UsbIdentity *usb) {
+    const char *value;
+
+    memset(usb, 0, sizeof(*usb));
+    if ((value = udev_device_get_property_value(device, "ID_VENDOR_ID"))) {
+        usb->vendor_id = (uint16_t)strtoul(value, NULL, 16);
+    }
+    if ((value = udev_device_get_property_value(device, "ID_MODEL_ID"))) {
+        usb->product_id = (uint16_t)strtoul(value, NULL, 16);
+    }
+    if ((value = udev_device_get_property_value(device, "ID_USB_INTERFACE_NUM"))) {
+        usb->interface = (uint8_t)strtoul(value, NULL, 16);
+    }
+    if ((value = udev_device_get_property_value(device, "ID_SERIAL_SHORT"))) {
+        snprintf(usb->serial, sizeof(usb->serial), "%s", value);
+    }
+    struct udev_device *usb_device = udev_device_get_parent_with_subsystem_devtype(device, "usb", "usb_device");
+    if (usb_device && (value = udev_device_get_sysname(usb_device))) {
+        snprintf(usb->port, sizeof(usb->port), "%s", value);
+    }
 }
 
-void scan_existing_devices(const DeviceTemplates *templates) {
-    DIR *dir;
-    struct dirent *ent;
+// serial_core's PORT_UNKNOWN, what 8250 reports for a port it found no
+// UART at
+#define UART_TYPE_UNKNOWN 0
 
-    printf("\nScanning existing devices...\n");
-    
-    if ((dir = opendir("/dev")) != NULL) {
-        while ((ent = readdir(dir)) != NULL) {
-            if (is_monitored_device(ent->d_name, templates)) {
-                char full_path[DEV_PATH_LEN];
-                snprintf(full_path, sizeof(full_path), "/dev/%s", ent->d_name);
-                
-                printf("\nFound existing device: %s\n", full_path);
-                print_device_info(ent->d_name);
-                start_mavlink_check(full_path);
-            }
+static unsigned long sysattr_number(struct udev_device *device, const char *name, bool *present) {
+    const char *value = udev_device_get_sysattr_value(device, name);
+    if (present) {
+        *present = value != NULL;
+    }
+    return value ? strtoul(value, NULL, 0) : 0;
+}
+
+// Sorts a port out before any probe is spent on it. The 8250 driver
+// registers ttyS0..ttyS31 whether or not there is a UART behind them;
+// serial_core's sysfs attributes tell those apart without touching the
+// port. Real UARTs are opened for a moment to read the modem lines and
+// the interrupt counters, activity there means something is attached and
+// the port is probed first. False for ports not worth a probe at all.
+static bool prescreen_port(struct udev_device *device, const char *devnode, ProbePriority *priority) {
+    bool has_type;
+    unsigned long type = sysattr_number(device, "type", &has_type);
+
+    // USB adapters and other non serial_core ttys exist if their node does
+    *priority = PROBE_PRIORITY_NORMAL;
+    if (!has_type) {
+        return true;
+    }
+
+    unsigned long port = sysattr_number(device, "port", NULL);
+    unsigned long iomem = sysattr_number(device, "iomem_base", NULL);
+    if (type == UART_TYPE_UNKNOWN || (port == 0 && iomem == 0)) {
+        printf("Skipping %s: no UART behind it (type %lu)\n", devnode, type);
+        return false;
+    }
+
+    int fd = open(devnode, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == EIO) {
+            printf("Skipping %s: no UART behind it (%s)\n", devnode, strerror(errno));
+            return false;
         }
-        closedir(dir);
+        // Busy or not accessible yet, the probe's open retries sort it out
+        return true;
+    }
+    int lines = 0;
+    struct serial_icounter_struct icount = {0};
+    bool lines_up = ioctl(fd, TIOCMGET, &lines) == 0 &&
+                    (lines & (TIOCM_CTS | TIOCM_DSR | TIOCM_CD | TIOCM_RI));
+    bool traffic = ioctl(fd, TIOCGICOUNT, &icount) == 0 &&
+                   (icount.rx || icount.frame || icount.brk);
+    close(fd);
+
+    if (lines_up || traffic) {
+        *priority = PROBE_PRIORITY_HIGH;
     } else {
-        perror("Could not open /dev directory");
+        // Nothing seen on the line yet, could well be an unused header
+        *priority = PROBE_PRIORITY_LOW;
     }
+    printf("UART %s: type %lu, irq %lu, %s\n", devnode, type, sysattr_number(device, "irq", NULL),
+           lines_up || traffic ? "line activity" : "no line activity");
+    return true;
 }
 
-void print_usage(const char *program_name) {
-    printf("Usage: %s <config.json> <ur-rpc-general-config.json> <ur-rpc-general-specific.json> \n", program_name);
+// Hands a port that passed the templates and the pre-screen to the probes
+static void queue_port(struct udev_device *device, const DeviceTemplateOptions *options,
+                       ProbePriority priority) {
+    UsbIdentity usb;
+
+    print_device_info(device);
+    read_usb_identity(device, &usb);
+    start_mavlink_check(udev_device_get_devnode(device), options, &usb, priority);
 }
 
-void cleanup_threads() {
+typedef struct {
+    struct udev_device *device;
+    int tmpl;
+    ProbePriority priority;
+} ScannedPort;
+
+// Enumerates the tty class through udev, which also hands over the
+// properties. Names are matched on the syspath before a udev_device is
+// built, so the dozens of virtual consoles cost next to nothing.
+void scan_existing_devices(const DeviceTemplates *templates) {
+    struct udev *udev = discovery_udev();
+    struct udev_enumerate *enumerate;
+    struct udev_list_entry *entry;
+
+    printf("\nScanning existing devices...\n");
+
+    // Only queues the probes, they run on the pool while the scan goes on
     pthread_mutex_lock(&devices_mutex);
-    for (int i = 0; i < device_count; i++) {
-        if (devices[i].thread_running) {
-            pthread_cancel(devices[i].thread);
-            pthread_join(devices[i].thread, NULL);
-            if (devices[i].serial) {
-                cssl_close(devices[i].serial);
+    startup.scanning = true;
+    startup.begin_ms = probe_now_ms();
+    pthread_mutex_unlock(&devices_mutex);
+
+    if (!udev || !(enumerate = udev_enumerate_new(udev))) {
+        fprintf(stderr, "Could not enumerate tty devices\n");
+        pthread_mutex_lock(&devices_mutex);
+        startup.scanning = false;
+        pthread_mutex_unlock(&devices_mutex);
+        return;
+    }
+    udev_enumerate_add_match_subsystem(enumerate, "tty");
+    udev_enumerate_scan_devices(enumerate);
+
+    // Pre-screened first, then queued real UARTs ahead of doubtful ones
+    ScannedPort *ports = NULL;
+    int port_count = 0;
+    udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(enumerate)) {
+        const char *syspath = udev_list_entry_get_name(entry);
+        const char *sysname = strrchr(syspath, '/');
+        if (!sysname || !is_monitored_device(sysname + 1, templates)) {
+            continue;
+        }
+
+        struct udev_device *device = udev_device_new_from_syspath(udev, syspath);
+        if (!device) {
+            continue;
+        }
+        const char *devnode = udev_device_get_devnode(device);
+        int tmpl = match_device_template(sysname + 1, device, templates);
+        ProbePriority priority;
+        if (devnode && tmpl >= 0 && prescreen_port(device, devnode, &priority)) {
+            ScannedPort *grown = realloc(ports, (port_count + 1) * sizeof(ScannedPort));
+            if (grown) {
+                ports = grown;
+                ports[port_count++] = (ScannedPort){ device, tmpl, priority };
+                continue;
+            }
+        }
+        udev_device_unref(device);
+    }
+    udev_enumerate_unref(enumerate);
+
+    for (ProbePriority priority = PROBE_PRIORITY_HIGH; priority <= PROBE_PRIORITY_LOW; priority++) {
+        for (int i = 0; i < port_count; i++) {
+            if (ports[i].priority != priority) {
+                continue;
             }
+            printf("\nFound existing device: %s\n", udev_device_get_devnode(ports[i].device));
+            queue_port(ports[i].device, &templates->options[ports[i].tmpl], ports[i].priority);
+            udev_device_unref(ports[i].device);
         }
     }
+    free(ports);
+
+    StartupInventory inventory;
+    pthread_mutex_lock(&devices_mutex);
+    startup.scanning = false;
+    bool complete = startup_inventory_complete(&inventory);
     pthread_mutex_unlock(&devices_mutex);
+    if (complete) {
+        report_inventory(&inventory);
+    }
+}
+
+// Netlink monitor for tty add/remove. It listens to "udev" rather than
+// "kernel" events: those come after the rules ran, so the node already has
+// its final permissions and properties.
+struct udev_monitor *start_hotplug_monitor(void) {
+    struct udev *udev = discovery_udev();
+    if (!udev) {
+        return NULL;
+    }
+
+    struct udev_monitor *monitor = udev_monitor_new_from_netlink(udev, "udev");
+    if (!monitor) {
+        fprintf(stderr, "Can't create udev monitor\n");
+        return NULL;
+    }
+    if (udev_monitor_filter_add_match_subsystem_devtype(monitor, "tty", NULL) < 0 ||
+        udev_monitor_enable_receiving(monitor) < 0) {
+        fprintf(stderr, "Can't start udev monitor\n");
+        udev_monitor_unref(monitor);
+        return NULL;
+    }
+    return monitor;
+}
+
+void stop_hotplug_monitor(struct udev_monitor *monitor) {
+    if (monitor) {
+        udev_monitor_unref(monitor);
+    }
+    if (udev_ctx) {
+        udev_unref(udev_ctx);
+        udev_ctx = NULL;
+    }
+}
+
+// Handles one pending event, call when the monitor fd is readable
+void handle_hotplug_event(struct udev_monitor *monitor, const DeviceTemplates *templates) {
+    struct udev_device *device = udev_monitor_receive_device(monitor);
+    if (!device) {
+        return;
+    }
+
+    const char *action = udev_device_get_action(device);
+    const char *sysname = udev_device_get_sysname(device);
+    const char *devnode = udev_device_get_devnode(device);
+
+    if (action && devnode && strcmp(action, "remove") == 0) {
+        // The parents are gone from sysfs by now, so the template
+        // predicates can't be evaluated; a node we track is ours to drop
+        char full_path[DEV_PATH_LEN];
+        snprintf(full_path, sizeof(full_path), "%s", devnode);
+        if (remove_device(full_path)) {
+            printf("\nDevice removed from: %s\n", full_path);
+            unregister_device_mavrouter(full_path);
+        }
+    } else if (action && devnode && sysname && strcmp(action, "add") == 0) {
+        int tmpl = match_device_template(sysname, device, templates);
+        if (tmpl >= 0) {
+            char full_path[DEV_PATH_LEN];
+            snprintf(full_path, sizeof(full_path), "%s", devnode);
+            printf("\nDevice added at: %s\n", full_path);
+            ProbePriority priority;
+            if (prescreen_port(device, full_path, &priority)) {
+                queue_port(device, &templates->options[tmpl], priority);
+            }
+        }
+    }
+    udev_device_unref(device);
+}
+
+void print_usage(const char *program_name) {
+    printf("Usage: %s <config.json> <ur-rpc-general-config.json> <ur-rpc-general-specific.json> \n", program_name);
+}
+
+void cleanup_threads() {
+    // Waits for the probe steps in flight, then closes every port still
+    // open; must run without devices_mutex held since finishing probes
+    // take it
+    probe_pool_stop();
     cssl_stop();
+    identity_cache_close();
 }
\ No newline at end of file
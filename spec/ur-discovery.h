@@ -1,16 +1,23 @@
+#ifndef __UR_DISCOVERY_H__
+#define __UR_DISCOVERY_H__
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/inotify.h>
 #include <libudev.h>
 #include <dirent.h>
 #include <stdbool.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <time.h>
 #include <cJSON.h>
 #include <cssl.h>
 #include <libmavlink.h>
+#include <ur-probe-pool.h>
+#include <ur-template-matcher.h>
+#include <ur-stream-classifier.h>
+#include <ur-gnss-parser.h>
 #include <ur-rpc-template.h>
 
 
@@ -20,15 +27,58 @@
 #define WEAK
 #endif
 
-#define EVENT_SIZE  (sizeof(struct inotify_event))
-#define BUF_LEN     (1024 * (EVENT_SIZE + 16))
 #define MAX_TEMPLATES 32
 #define MAX_TEMPLATE_LEN 64
+#define MAX_TEMPLATE_PREDICATES 8
+#define MAX_PROPERTY_LEN 32
 #define DEV_PATH_LEN 256
 #define MAVLINK_TIMEOUT_MS 2500
-#define MAX_DEVICES 100
 #define HEARTBEAT_REQUEST_INTERVAL_MS 500
 #define INFO_COLLECTION_TIMEOUT_MS 3000
+// The version request is repeated while collecting, the delay doubling
+// from MAVLINK_RETRY_INITIAL_MS. After MAVLINK_FALLBACK_AFTER unanswered
+// tries the older MAV_CMD_REQUEST_AUTOPILOT_CAPABILITIES goes along.
+#define MAVLINK_RETRY_INITIAL_MS 150
+#define MAVLINK_RETRY_MAX_MS 1200
+#define MAVLINK_FALLBACK_AFTER 2
+#define MAVLINK_HANDSHAKE_FRAMES 4
+// Broadcasts go out in MAVLink 2 framing; after this many went unanswered
+// every other one is sent in MAVLink 1 for firmware that only speaks that
+#define MAVLINK_V1_AFTER 2
+// Checksummed sentences or frames before a port counts as a GNSS receiver,
+// and how long it gets to answer the version poll. Receivers with UBX
+// output off never answer and are published with what they printed.
+#define GNSS_DETECT_FRAMES 2
+#define GNSS_VERSION_TIMEOUT_MS 1000
+// A board found in its bootloader is expected back in application mode on
+// the same USB port or with the same serial within this time
+#define BOOT_WATCH_MS 15000
+#define MAX_BOOT_WATCHES 8
+// listen_first: longest passive window before the probers start to
+// transmit. Once a template has seen LISTEN_TUNE_SAMPLES devices speak up
+// on their own, its window is cut to half again the longest they took.
+#define DEFAULT_LISTEN_MS 1500
+#define MIN_LISTEN_MS 100
+#define LISTEN_TUNE_SAMPLES 4
+#define MAX_BAUD_RATES 16
+#define DEFAULT_BAUD_RATE 115200
+// Autobaud: how long a candidate rate is kept before judging it, how much
+// evidence moves on to the next one, and how long a silent line is given
+#define AUTOBAUD_MIN_DWELL_MS 100
+#define AUTOBAUD_ERROR_THRESHOLD 3
+#define AUTOBAUD_GARBAGE_BYTES 64
+#define AUTOBAUD_SILENT_WINDOW_MS 1100
+// A node that just appeared may still be getting its owner/mode from
+// udev, or be held by a modem manager sniffing it; such opens are retried
+// with a doubling backoff for a bounded time
+#define OPEN_RETRY_INITIAL_MS 5
+#define OPEN_RETRY_MAX_DELAY_MS 200
+#define OPEN_RETRY_BUDGET_MS 3000
+#define USB_SERIAL_LEN 64
+#define USB_PORT_LEN 32
+#define MAX_PROBERS 8
+#define DEFAULT_IDENTITY_CACHE_PATH "/var/lib/ur-mavdiscovery/identity-cache"
+#define DISCOVERY_STATUS_TOPIC "ur-mavdiscovery-status"
 
 // Structure to hold collected PX4 device information
 typedef struct {
@@ -46,22 +96,225 @@ typedef struct {
     char manufacturer[20];
 } PX4DeviceInfo;
 
+// Message set a MAVLink device speaks, as far as its traffic tells
+typedef enum {
+    MAVLINK_DIALECT_UNKNOWN,
+    MAVLINK_DIALECT_COMMON,
+    MAVLINK_DIALECT_ARDUPILOTMEGA,
+    MAVLINK_DIALECT_PX4
+} MavlinkDialect;
+
+// Request frames encoded back to back, sent in a single write
+typedef struct {
+    uint8_t buf[MAVLINK_HANDSHAKE_FRAMES * MAVLINK_MAX_PACKET_LEN];
+    uint16_t len;
+} MavlinkHandshake;
+
+// USB identity of the adapter or board behind a tty, from udev. Devices
+// without a serial number can't be told apart across replugs and have
+// serial[0] == 0.
+typedef struct {
+    uint16_t vendor_id;
+    uint16_t product_id;
+    uint8_t interface; // composite boards expose several ttys per serial
+    char serial[USB_SERIAL_LEN];
+    char port[USB_PORT_LEN]; // bus position, e.g. "1-1.2"; not part of the key
+} UsbIdentity;
+
+// What a completed probe learnt about a device, as kept across replugs
+typedef struct {
+    int32_t baud;
+    uint8_t sysid;
+    uint8_t compid;
+    uint8_t mavlink_version;
+    uint8_t dialect; // MavlinkDialect
+    PX4DeviceInfo px4_info;
+} ProbeResult;
+
+// A udev condition on a template: the property value must match a glob.
+// An empty property name stands for the kernel driver of the device or
+// its nearest parent that has one.
+typedef struct {
+    char property[MAX_PROPERTY_LEN];
+    GlobSet value;
+} TemplatePredicate;
+
+typedef struct {
+    TemplatePredicate items[MAX_TEMPLATE_PREDICATES];
+    int count;
+} TemplatePredicates;
+
+typedef enum {
+    PROBE_STRATEGY_ACTIVE,      // query the port from the start
+    PROBE_STRATEGY_LISTEN_FIRST // stay silent while the device may speak up on its own
+} ProbeStrategy;
+
+// How long devices behind a template took to be recognised without being
+// asked, i.e. their heartbeat or output cadence
 typedef struct {
+    atomic_int samples;
+    atomic_int longest_ms;
+} ListenTuning;
+
+// Per-template probing options from the discovery config
+typedef struct {
+    int baud_rates[MAX_BAUD_RATES]; // tried in order
+    int baud_count;
+    uint32_t probers; // bit i enables prober_table[i]
+    ProbeStrategy strategy;
+    int listen_ms; // upper bound of the listen_first window
+    ListenTuning *tuning; // the template's, NULL to not tune
+} DeviceTemplateOptions;
+
+typedef enum {
+    AUTOBAUD_WAIT,   // not enough evidence yet
+    AUTOBAUD_SWITCH, // traffic is not decodable at this rate
+    AUTOBAUD_LOCKED  // valid frames at this rate
+} AutobaudVerdict;
+
+// Counters at the start of a baud window, the verdict works on deltas
+typedef struct {
+    unsigned int frames_ok;
+    unsigned int parse_errors;
+    unsigned int crc_errors;
+    StreamSnapshot stream;
+    unsigned long rx_bytes;
+    unsigned long line_errors;
+    bool has_line_errors;
+} AutobaudWindow;
+
+// Where a device probe stands, advanced by probe_step on the pool workers
+typedef enum {
+    PROBE_OPENING,    // port not open yet
+    PROBE_LISTENING,  // probers querying the port, walking the baud list
+    PROBE_COLLECTING, // one prober detected its protocol, waiting for details
+    PROBE_FINISHED
+} ProbeState;
+
+struct DeviceInfo;
+
+// How far a prober got on a port, it only ever moves up
+typedef enum {
+    PROBER_LISTENING,  // nothing recognised yet
+    PROBER_DETECTED,   // the port speaks the prober's protocol
+    PROBER_IDENTIFIED  // and what the prober wanted to know is in
+} ProberStatus;
+
+// One kind of device discovery can recognise. All probers that apply to a
+// port see the same bytes from a single open; the first to detect its
+// protocol owns the port from then on, the others stop being fed.
+// Everything but match runs on the probe worker, hooks may be NULL.
+typedef struct {
+    const char *name;
+    int collect_timeout_ms; // from detection to giving up on the details
+    // Whether to look for this protocol on a port at all
+    bool (*applies)(const struct DeviceInfo *dev);
+    // Once per probe, before the port is opened. May already recognise
+    // the device from what udev told, then the port is not opened at all.
+    ProberStatus (*start)(struct DeviceInfo *dev, uint64_t now);
+    // Every HEARTBEAT_REQUEST_INTERVAL_MS while listening, e.g. to query
+    void (*poke)(struct DeviceInfo *dev, uint64_t now);
+    // While collecting, first right after detected: ask for the details
+    // (again). Returns when to be called next.
+    uint64_t (*retry)(struct DeviceInfo *dev, uint64_t now);
+    // Received bytes, on the cssl decoder thread
+    ProberStatus (*match)(struct DeviceInfo *dev, const uint8_t *buf, int length);
+    // The port switched rates or is closed, drop partial frames (decoder
+    // thread, or the worker once the port is closed)
+    void (*resync)(struct DeviceInfo *dev);
+    // This prober owns the port, e.g. ask for details
+    void (*detected)(struct DeviceInfo *dev, uint64_t now);
+    // Identified, publish what was learnt
+    void (*publish)(struct DeviceInfo *dev);
+    // The details did not come in time; called once the port is closed
+    void (*expired)(struct DeviceInfo *dev);
+} Prober;
+
+typedef struct {
+    const Prober *prober;
+    ProberStatus status; // written by the decoder, handed over under probe_lock
+} ProberSlot;
+
+typedef struct DeviceInfo {
     char path[DEV_PATH_LEN];
     bool mavlink_valid;
-    pthread_t thread;
-    bool thread_running;
+    bool probing; // a probe job is submitted and not finished yet
+    atomic_bool removed; // the /dev node went away
+    bool startup; // found by the startup scan, devices_mutex
+    struct DeviceInfo *path_next; // registry path bucket chain
     cssl_t *serial;
     int id;
     bool heartbeat_received;
     bool info_collected;
+    uint8_t sysid; // of the first heartbeat
+    uint8_t compid;
     PX4DeviceInfo px4_info;
-    time_t info_request_time;
+    bool info_from_cache; // px4_info is the cached copy, not confirmed yet
+    atomic_bool request_refused; // MAV_CMD_REQUEST_MESSAGE was NACKed
+    uint16_t protocol_version; // from PROTOCOL_VERSION, 0 until answered
+    uint16_t min_protocol_version;
+    uint16_t max_protocol_version;
+    uint8_t mavlink_version; // framing of the device's last frame, 0 until one came
+    MavlinkDialect dialect;
+    // The MAVLink flags above belong to the cssl decoder; what the worker
+    // reads of them is ordered by the prober status handover
+    ProberSlot probers[MAX_PROBERS]; // those that apply to this port
+    int prober_count;
+    atomic_int owner; // index into probers once one detected, else -1
+    pthread_mutex_t probe_lock;
+    libmavlink_parser_t parser; // owned by the cssl reactor while the port is open
+    StreamClassifier classifier; // same
+    GnssParser gnss_parser; // same
+    GnssInfo gnss; // written by the decoder, like the MAVLink flags
+    int bootloader_replies; // INSYNC/OK pairs, same
+    uint8_t bootloader_pending; // first byte of a pair, 0 if none
+    bool bootloader_foreign; // anything else came in
+    DeviceTemplateOptions options;
+    atomic_int baud; // rate the port is currently probed at
+    int parser_baud; // rate the parser state was built at
+    UsbIdentity usb;
+    bool cache_hit; // cached is valid, set before the port opens
+    ProbeResult cached;
+    // Probe progress, only touched from probe_step
+    ProbeJob job;
+    ProbeState probe_state;
+    bool registered; // announced to the router
+    uint64_t registered_ms;
+    uint64_t first_open_ms; // first open attempt
+    int open_retries;
+    long open_ms; // first attempt to successful open
+    int baud_index;
+    bool baud_locked;
+    AutobaudWindow window;
+    StreamKind detected; // what the port turned out to carry instead
+    uint64_t window_start_ms;
+    uint64_t next_request_ms;
+    bool passive; // listen_first, nothing transmitted yet
+    uint64_t listen_start_ms;
+    uint64_t listen_until_ms;
+    uint64_t info_deadline_ms;
+    MavlinkHandshake handshake; // targeted at sysid/compid once detected
+    MavlinkHandshake fallback;
+    int mavlink_pokes; // broadcasts sent while listening
+    int info_requests; // handshakes sent while collecting
 } DeviceInfo;
 
+// allowed_templates and denied_templates, each compiled into one GlobSet
+// whose rule numbers index the arrays here
 typedef struct {
     char templates[MAX_TEMPLATES][MAX_TEMPLATE_LEN];
+    DeviceTemplateOptions options[MAX_TEMPLATES];
+    TemplatePredicates predicates[MAX_TEMPLATES];
+    ListenTuning listen_tuning[MAX_TEMPLATES];
+    GlobSet allowed_set;
     int count;
+    char denied[MAX_TEMPLATES][MAX_TEMPLATE_LEN];
+    TemplatePredicates denied_predicates[MAX_TEMPLATES];
+    GlobSet denied_set;
+    int denied_count;
+    int probe_concurrency; // probe steps run at once
+    int probes_in_flight; // devices probed at once
+    char identity_cache[DEV_PATH_LEN]; // empty disables the cache
 } DeviceTemplates;
 
 // Process autopilot version information
@@ -139,24 +392,35 @@ static const DeviceIdentifier known_devices[] = {
 };
 
 
-static DeviceInfo devices[MAX_DEVICES];
-static int device_count = 0;
-static pthread_mutex_t devices_mutex = PTHREAD_MUTEX_INITIALIZER;
-
 bool load_templates_from_json(const char *filename, DeviceTemplates *templates);
+void free_templates(DeviceTemplates *templates);
+int match_device_template(const char *devname, struct udev_device *device, const DeviceTemplates *templates);
 bool is_monitored_device(const char *devname, const DeviceTemplates *templates);
-void send_heartbeat_request(cssl_t *serial);
-void send_autopilot_version_request(cssl_t *serial);
+void mavlink_handshake_encode(MavlinkHandshake *handshake, uint8_t target_system,
+                              uint8_t target_component, bool fallback, bool mavlink1);
+const char *mavlink_dialect_name(MavlinkDialect dialect);
 void identify_device(DeviceInfo *dev);
 void process_autopilot_version(mavlink_message_t *msg, DeviceInfo *dev);
 void print_px4_device_info(DeviceInfo *dev);
-void mavlink_callback(int id, uint8_t *buf, int length);
+void probe_data_callback(int id, uint8_t *buf, int length);
+void autobaud_window_start(DeviceInfo *dev, AutobaudWindow *window);
+AutobaudVerdict autobaud_check(DeviceInfo *dev, const AutobaudWindow *window, long elapsed_ms);
+
+extern const Prober mavlink_prober;
+extern const Prober gnss_prober;
+extern const Prober bootloader_prober;
 
-void* check_mavlink_device(void *arg);
-void start_mavlink_check(const char *devpath);
+bool start_probe_pool(const DeviceTemplates *templates);
+void start_mavlink_check(const char *devpath, const DeviceTemplateOptions *options, const UsbIdentity *usb,
+                         ProbePriority priority);
+bool remove_device(const char *devpath);
+void expect_application_port(const UsbIdentity *usb);
 
-void print_device_info(const char *devname);
+void print_device_info(struct udev_device *device);
 void scan_existing_devices(const DeviceTemplates *templates);
+struct udev_monitor *start_hotplug_monitor(void);
+void stop_hotplug_monitor(struct udev_monitor *monitor);
+void handle_hotplug_event(struct udev_monitor *monitor, const DeviceTemplates *templates);
 void print_usage(const char *program_name);
 void cleanup_threads();
 void register_device_mavrouter(char* dev_path);
@@ -180,3 +444,5 @@ void unregister_device_mavrouter(char* dev_path);
     char* serialize_device_info_transport(const DeviceInfoTransport* info);
     void free_device_info_transport(DeviceInfoTransport* info);
 #endif
+
+#endif
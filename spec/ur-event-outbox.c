@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <ur-rpc-template.h>
+#include <ur-event-outbox.h>
+
+typedef enum {
+    OUTBOX_PUBLISH,      // json on topic
+    OUTBOX_ROUTER_STATE  // enable/disable dev_path on topic
+} OutboxKind;
+
+typedef struct OutboxEvent {
+    struct OutboxEvent *next;
+    OutboxKind kind;
+    bool enable;
+    char *topic;
+    char *payload; // json, or the device path
+} OutboxEvent;
+
+// Held across the publish itself, that is what keeps the order
+static pthread_mutex_t outbox_mutex = PTHREAD_MUTEX_INITIALIZER;
+static OutboxEvent *outbox_head = NULL;
+static OutboxEvent *outbox_tail = NULL;
+static int outbox_count = 0;
+static unsigned long outbox_dropped = 0;
+// Readable while a backlog waits, so the main loop knows to retry it
+static int outbox_fd = -1;
+static pthread_once_t outbox_once = PTHREAD_ONCE_INIT;
+
+static void outbox_init(void) {
+    outbox_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (outbox_fd < 0) {
+        perror("eventfd");
+    }
+}
+
+int outbox_get_fd(void) {
+    pthread_once(&outbox_once, outbox_init);
+    return outbox_fd;
+}
+
+// context is set up by main before any probe can publish
+static bool broker_reachable(void) {
+    return context && atomic_load(&context->mqtt_monitor.healthy);
+}
+
+static void deliver(OutboxKind kind, const char *topic, const char *payload, bool enable) {
+    if (kind == OUTBOX_PUBLISH) {
+        publish_to_custom_topic(topic, payload);
+    } else {
+        DeviceState state = {
+            .dev_path = (char *)payload,
+            .enable = enable
+        };
+        serialize_device_state(&state, NULL, topic);
+    }
+}
+
+static void free_event(OutboxEvent *event) {
+    free(event->topic);
+    free(event->payload);
+    free(event);
+}
+
+// Called with outbox_mutex held
+static void enqueue(OutboxKind kind, const char *topic, const char *payload, bool enable) {
+    OutboxEvent *event = calloc(1, sizeof(OutboxEvent));
+    if (!event || !(event->topic = strdup(topic)) || !(event->payload = strdup(payload))) {
+        fprintf(stderr, "Out of memory, dropping event for %s\n", topic);
+        if (event) {
+            free_event(event);
+        }
+        return;
+    }
+    event->kind = kind;
+    event->enable = enable;
+
+    if (outbox_count == OUTBOX_MAX_EVENTS) {
+        OutboxEvent *oldest = outbox_head;
+        outbox_head = oldest->next;
+        free_event(oldest);
+        outbox_count--;
+        if (outbox_dropped++ == 0) {
+            fprintf(stderr, "Broker unreachable, %d events queued, dropping the oldest\n",
+                    OUTBOX_MAX_EVENTS);
+        }
+    }
+    if (outbox_head) {
+        outbox_tail->next = event;
+    } else {
+        outbox_head = event;
+        if (outbox_fd >= 0) {
+            uint64_t one = 1;
+            write(outbox_fd, &one, sizeof(one));
+        }
+    }
+    outbox_tail = event;
+    outbox_count++;
+}
+
+static void submit(OutboxKind kind, const char *topic, const char *payload, bool enable) {
+    if (!payload) {
+        return;
+    }
+    pthread_once(&outbox_once, outbox_init);
+    pthread_mutex_lock(&outbox_mutex);
+    if (!outbox_head && broker_reachable()) {
+        deliver(kind, topic, payload, enable);
+    } else {
+        enqueue(kind, topic, payload, enable);
+    }
+    pthread_mutex_unlock(&outbox_mutex);
+}
+
+void outbox_publish(const char *topic, const char *json) {
+    submit(OUTBOX_PUBLISH, topic, json, false);
+}
+
+void outbox_router_state(const char *topic, const char *dev_path, bool enable) {
+    submit(OUTBOX_ROUTER_STATE, topic, dev_path, enable);
+}
+
+// Replays what was held if the broker is reachable now. Returns true while
+// events are still waiting, the caller should try again a bit later.
+bool outbox_flush(void) {
+    pthread_once(&outbox_once, outbox_init);
+    pthread_mutex_lock(&outbox_mutex);
+    if (outbox_fd >= 0) {
+        uint64_t count;
+        read(outbox_fd, &count, sizeof(count));
+    }
+    if (outbox_head && broker_reachable()) {
+        printf("Broker reachable, replaying %d queued events\n", outbox_count);
+        if (outbox_dropped) {
+            fprintf(stderr, "%lu events were dropped while the broker was unreachable\n",
+                    outbox_dropped);
+            outbox_dropped = 0;
+        }
+        while (outbox_head) {
+            OutboxEvent *event = outbox_head;
+            outbox_head = event->next;
+            deliver(event->kind, event->topic, event->payload, event->enable);
+            free_event(event);
+        }
+        outbox_tail = NULL;
+        outbox_count = 0;
+    }
+    bool pending = outbox_head != NULL;
+    pthread_mutex_unlock(&outbox_mutex);
+    return pending;
+}
@@ -0,0 +1,19 @@
+#ifndef __UR_EVENT_OUTBOX_H__
+#define __UR_EVENT_OUTBOX_H__
+
+#include <stdbool.h>
+
+// Discovery results go out over MQTT, but probing starts before the broker
+// connection is up. Anything published while the broker isn't reachable is
+// held here and replayed in order once it is; later events queue behind
+// the held ones so a device's register/unregister never overtake each
+// other. When the backlog is full the oldest events are dropped.
+#define OUTBOX_MAX_EVENTS 256
+#define OUTBOX_RETRY_MS 50 // how often a held backlog is offered again
+
+void outbox_publish(const char *topic, const char *json);
+void outbox_router_state(const char *topic, const char *dev_path, bool enable);
+int outbox_get_fd(void);
+bool outbox_flush(void);
+
+#endif
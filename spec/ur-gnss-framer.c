@@ -0,0 +1,147 @@
+#include <ur-gnss-framer.h>
+
+enum {
+    UBX_SYNC1,
+    UBX_SYNC2,
+    UBX_CLASS,
+    UBX_ID,
+    UBX_LEN1,
+    UBX_LEN2,
+    UBX_PAYLOAD,
+    UBX_CK_A,
+    UBX_CK_B
+};
+
+// Drops partial frames
+void gnss_framer_resync(GnssFramer *framer) {
+    framer->nmea_len = 0;
+    framer->ubx_state = UBX_SYNC1;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+// "$GPGGA,...*hh" without the line end
+bool nmea_sentence_valid(const char *line, int len) {
+    if (len < 9 || line[len - 3] != '*') {
+        return false;
+    }
+    int hi = hex_value(line[len - 2]);
+    int lo = hex_value(line[len - 1]);
+    if (hi < 0 || lo < 0) {
+        return false;
+    }
+    uint8_t sum = 0;
+    for (int i = 1; i < len - 3; i++) {
+        sum ^= (uint8_t)line[i];
+    }
+    return sum == ((hi << 4) | lo);
+}
+
+static bool feed_nmea(GnssFramer *f, uint8_t byte) {
+    bool complete = false;
+
+    if (byte == '$' || byte == '!') {
+        f->nmea_line[0] = (char)byte;
+        f->nmea_len = 1;
+    } else if (!f->nmea_len) {
+        return false;
+    } else if (byte == '\r' || byte == '\n') {
+        f->nmea_line[f->nmea_len] = '\0';
+        complete = nmea_sentence_valid(f->nmea_line, f->nmea_len);
+        f->sentence_len = complete ? f->nmea_len : 0;
+        f->nmea_len = 0;
+    } else if (byte < 0x20 || byte > 0x7e || f->nmea_len == NMEA_MAX_SENTENCE) {
+        f->nmea_len = 0;
+    } else {
+        f->nmea_line[f->nmea_len++] = (char)byte;
+    }
+    return complete;
+}
+
+static void ubx_checksum(GnssFramer *f, uint8_t byte) {
+    f->ubx_ck_a += byte;
+    f->ubx_ck_b += f->ubx_ck_a;
+}
+
+static bool feed_ubx(GnssFramer *f, uint8_t byte, uint8_t *payload, uint16_t payload_size) {
+    switch (f->ubx_state) {
+    case UBX_SYNC1:
+        if (byte == UBX_SYNC_CHAR1) {
+            f->ubx_state = UBX_SYNC2;
+        }
+        return false;
+    case UBX_SYNC2:
+        f->ubx_state = byte == UBX_SYNC_CHAR2 ? UBX_CLASS : byte == UBX_SYNC_CHAR1 ? UBX_SYNC2 : UBX_SYNC1;
+        f->ubx_ck_a = f->ubx_ck_b = 0;
+        return false;
+    case UBX_CLASS:
+        ubx_checksum(f, byte);
+        f->ubx_class = byte;
+        f->ubx_state = UBX_ID;
+        return false;
+    case UBX_ID:
+        ubx_checksum(f, byte);
+        f->ubx_id = byte;
+        f->ubx_state = UBX_LEN1;
+        return false;
+    case UBX_LEN1:
+        ubx_checksum(f, byte);
+        f->ubx_len = byte;
+        f->ubx_state = UBX_LEN2;
+        return false;
+    case UBX_LEN2:
+        ubx_checksum(f, byte);
+        f->ubx_len |= (uint16_t)byte << 8;
+        f->ubx_pos = 0;
+        if (f->ubx_len > UBX_MAX_PAYLOAD) {
+            f->ubx_state = UBX_SYNC1;
+        } else {
+            f->ubx_state = f->ubx_len ? UBX_PAYLOAD : UBX_CK_A;
+        }
+        return false;
+    case UBX_PAYLOAD:
+        ubx_checksum(f, byte);
+        if (f->ubx_len <= payload_size) {
+            payload[f->ubx_pos] = byte;
+        }
+        if (++f->ubx_pos == f->ubx_len) {
+            f->ubx_state = UBX_CK_A;
+        }
+        return false;
+    case UBX_CK_A:
+        f->ubx_state = byte == f->ubx_ck_a ? UBX_CK_B : UBX_SYNC1;
+        return false;
+    case UBX_CK_B:
+        f->ubx_state = UBX_SYNC1;
+        return byte == f->ubx_ck_b;
+    }
+    return false;
+}
+
+// Runs both decoders over one byte and returns the frames it completed,
+// valid until the next byte is fed. An NMEA sentence is in nmea_line,
+// sentence_len long. A UBX frame is ubx_class, ubx_id and ubx_len; its
+// payload was copied to payload only if it fits in payload_size, which
+// may be 0 to only check frames.
+unsigned int gnss_framer_feed(GnssFramer *framer, uint8_t byte, uint8_t *payload, uint16_t payload_size) {
+    unsigned int frames = 0;
+
+    if (feed_nmea(framer, byte)) {
+        frames |= GNSS_FRAME_NMEA;
+    }
+    if (feed_ubx(framer, byte, payload, payload_size)) {
+        frames |= GNSS_FRAME_UBX;
+    }
+    return frames;
+}
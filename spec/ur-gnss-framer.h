@@ -0,0 +1,40 @@
+#ifndef __UR_GNSS_FRAMER_H__
+#define __UR_GNSS_FRAMER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Splits a byte stream into the two kinds of frames GNSS receivers send:
+// checksummed NMEA sentences and UBX frames. Both decoders run on every
+// byte, a stream may interleave them. The stream classifier only counts
+// what comes out, the GNSS parser reads the sentences and payloads.
+// All zero is a valid initial state.
+#define NMEA_MAX_SENTENCE 82
+#define UBX_MAX_PAYLOAD 2048 // real messages are smaller, longer is a false sync
+#define UBX_SYNC_CHAR1 0xB5
+#define UBX_SYNC_CHAR2 0x62
+
+// What gnss_framer_feed completed, as flags
+#define GNSS_FRAME_NMEA 0x01
+#define GNSS_FRAME_UBX 0x02
+
+typedef struct {
+    // NMEA: '$' or '!' up to the line end, NUL terminated once complete
+    char nmea_line[NMEA_MAX_SENTENCE + 1];
+    int nmea_len;
+    int sentence_len; // of the sentence the last byte completed
+    // UBX: B5 62 class id len16 payload ck_a ck_b
+    int ubx_state;
+    uint8_t ubx_class;
+    uint8_t ubx_id;
+    uint16_t ubx_len;
+    uint16_t ubx_pos;
+    uint8_t ubx_ck_a;
+    uint8_t ubx_ck_b;
+} GnssFramer;
+
+void gnss_framer_resync(GnssFramer *framer);
+unsigned int gnss_framer_feed(GnssFramer *framer, uint8_t byte, uint8_t *payload, uint16_t payload_size);
+bool nmea_sentence_valid(const char *line, int len);
+
+#endif
@@ -0,0 +1,179 @@
+#include <string.h>
+#include <ur-gnss-parser.h>
+
+// MON-VER: swVersion[30] hwVersion[10], then extension strings of 30
+#define MON_VER_SW_LEN 30
+#define MON_VER_HW_LEN 10
+#define MON_VER_EXT_LEN 30
+
+// u-blox generation by MON-VER hwVersion, for receivers too old to
+// report MOD=
+static const struct {
+    const char *hw_version;
+    const char *model;
+} ublox_generations[] = {
+    {"00040005", "u-blox 5"},
+    {"00040007", "u-blox 6"},
+    {"00070000", "u-blox 7"},
+    {"00080000", "u-blox M8"},
+    {"00190000", "u-blox F9"},
+    {"000A0000", "u-blox M10"},
+};
+
+void gnss_parser_init(GnssParser *parser) {
+    memset(parser, 0, sizeof(*parser));
+}
+
+// Drops partial frames
+void gnss_parser_resync(GnssParser *parser) {
+    gnss_framer_resync(&parser->framer);
+}
+
+// Copies a device supplied string, at most len bytes of it, keeping only
+// what can go into a JSON string as is
+static void copy_text(char *dst, const char *src, int len) {
+    int n = 0;
+    for (int i = 0; i < len && src[i] && n < GNSS_VERSION_LEN - 1; i++) {
+        if (src[i] >= 0x20 && src[i] <= 0x7e && src[i] != '"' && src[i] != '\\') {
+            dst[n++] = src[i];
+        }
+    }
+    while (n > 0 && dst[n - 1] == ' ') {
+        n--;
+    }
+    dst[n] = '\0';
+}
+
+// "KEY=value" version strings, from MON-VER extensions or TXT sentences
+static void version_field(GnssInfo *info, const char *text, int len) {
+    if (len > 4 && strncmp(text, "MOD=", 4) == 0) {
+        copy_text(info->model, text + 4, len - 4);
+    } else if (len > 6 && strncmp(text, "FWVER=", 6) == 0) {
+        copy_text(info->fw_version, text + 6, len - 6);
+    } else if (len > 8 && strncmp(text, "PROTVER=", 8) == 0) {
+        copy_text(info->protocol_version, text + 8, len - 8);
+    }
+}
+
+static void set_ublox(GnssInfo *info) {
+    if (!info->vendor[0]) {
+        strcpy(info->vendor, "u-blox");
+    }
+}
+
+static void decode_mon_ver(GnssParser *p, GnssInfo *info) {
+    const char *payload = (const char *)p->ubx_payload;
+    int len = p->framer.ubx_len;
+
+    if (len < MON_VER_SW_LEN + MON_VER_HW_LEN) {
+        return;
+    }
+    copy_text(info->sw_version, payload, MON_VER_SW_LEN);
+    copy_text(info->hw_version, payload + MON_VER_SW_LEN, MON_VER_HW_LEN);
+    for (int pos = MON_VER_SW_LEN + MON_VER_HW_LEN; pos + MON_VER_EXT_LEN <= len;
+         pos += MON_VER_EXT_LEN) {
+        version_field(info, payload + pos, strnlen(payload + pos, MON_VER_EXT_LEN));
+    }
+    if (!info->model[0]) {
+        for (size_t i = 0; i < sizeof(ublox_generations) / sizeof(ublox_generations[0]); i++) {
+            if (strcmp(info->hw_version, ublox_generations[i].hw_version) == 0) {
+                strcpy(info->model, ublox_generations[i].model);
+            }
+        }
+    }
+    info->version_received = true;
+}
+
+// "$GPTXT,01,01,02,MOD=NEO-M8N*hh": the text is the fifth field
+static void decode_txt(GnssInfo *info, const char *line, int len) {
+    int commas = 0;
+    int start = 0;
+    for (int i = 0; i < len && commas < 4; i++) {
+        if (line[i] == ',' && ++commas == 4) {
+            start = i + 1;
+        }
+    }
+    if (commas < 4) {
+        return;
+    }
+    const char *text = line + start;
+    int text_len = len - 3 - start; // up to the '*'
+    if (text_len <= 0) {
+        return;
+    }
+
+    if (memmem(text, text_len, "u-blox", 6)) {
+        set_ublox(info);
+    }
+    if (text_len > 3 && strncmp(text, "HW ", 3) == 0) {
+        copy_text(info->hw_version, text + 3, text_len - 3);
+    } else {
+        version_field(info, text, text_len);
+    }
+}
+
+static void nmea_sentence(GnssInfo *info, const char *line, int len) {
+    info->nmea_sentences++;
+    if (line[1] == 'P') {
+        // Proprietary, $PUBX is u-blox's
+        if (len > 5 && strncmp(line + 2, "UBX", 3) == 0) {
+            set_ublox(info);
+        }
+        return;
+    }
+    if (!info->talker[0]) {
+        info->talker[0] = line[1];
+        info->talker[1] = line[2];
+    }
+    if (len > 7 && strncmp(line + 3, "TXT,", 4) == 0) {
+        decode_txt(info, line, len);
+    }
+}
+
+// One checksummed frame from the framer; UBX payloads too long to keep
+// still count
+static void ubx_frame(GnssParser *p, GnssInfo *info) {
+    info->ubx_frames++;
+    set_ublox(info);
+    if (p->framer.ubx_class == UBX_CLASS_MON && p->framer.ubx_id == UBX_ID_MON_VER &&
+        p->framer.ubx_len <= GNSS_UBX_MAX_PAYLOAD) {
+        decode_mon_ver(p, info);
+    }
+}
+
+void gnss_parser_feed(GnssParser *parser, GnssInfo *info, const uint8_t *buf, int length) {
+    GnssFramer *framer = &parser->framer;
+
+    for (int i = 0; i < length; i++) {
+        unsigned int frames = gnss_framer_feed(framer, buf[i], parser->ubx_payload,
+                                               GNSS_UBX_MAX_PAYLOAD);
+        // '!' sentences are AIS, not from the receiver
+        if ((frames & GNSS_FRAME_NMEA) && framer->nmea_line[0] == '$') {
+            nmea_sentence(info, framer->nmea_line, framer->sentence_len);
+        }
+        if (frames & GNSS_FRAME_UBX) {
+            ubx_frame(parser, info);
+        }
+    }
+}
+
+// Empty UBX message of the given class and id, which polls it. Returns
+// the frame length, frame needs room for 8 bytes.
+int gnss_encode_poll(uint8_t *frame, uint8_t msg_class, uint8_t msg_id) {
+    uint8_t ck_a = 0;
+    uint8_t ck_b = 0;
+
+    frame[0] = UBX_SYNC_CHAR1;
+    frame[1] = UBX_SYNC_CHAR2;
+    frame[2] = msg_class;
+    frame[3] = msg_id;
+    frame[4] = 0;
+    frame[5] = 0;
+    for (int i = 2; i < 6; i++) {
+        ck_a += frame[i];
+        ck_b += ck_a;
+    }
+    frame[6] = ck_a;
+    frame[7] = ck_b;
+    return 8;
+}
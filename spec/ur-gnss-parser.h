@@ -0,0 +1,42 @@
+#ifndef __UR_GNSS_PARSER_H__
+#define __UR_GNSS_PARSER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <ur-gnss-framer.h>
+
+// Decodes what a GNSS receiver sends on its own: checksummed NMEA
+// sentences and UBX frames, keeping what tells the receiver apart. The
+// version comes from the UBX MON-VER answer, or from the TXT sentences
+// u-blox receivers print at startup when UBX output is off. Owned by the
+// cssl decoder thread of the port.
+#define GNSS_UBX_MAX_PAYLOAD 1024 // kept up to this, MON-VER is far shorter
+#define GNSS_VERSION_LEN 32
+
+#define UBX_CLASS_MON 0x0A
+#define UBX_ID_MON_VER 0x04
+
+typedef struct {
+    unsigned int nmea_sentences;
+    unsigned int ubx_frames;
+    char talker[3];       // of the first sentence, e.g. "GN"
+    char vendor[GNSS_VERSION_LEN];
+    char model[GNSS_VERSION_LEN];
+    char sw_version[GNSS_VERSION_LEN];
+    char hw_version[GNSS_VERSION_LEN];
+    char fw_version[GNSS_VERSION_LEN];
+    char protocol_version[GNSS_VERSION_LEN];
+    bool version_received; // MON-VER decoded
+} GnssInfo;
+
+typedef struct {
+    GnssFramer framer;
+    uint8_t ubx_payload[GNSS_UBX_MAX_PAYLOAD];
+} GnssParser;
+
+void gnss_parser_init(GnssParser *parser);
+void gnss_parser_resync(GnssParser *parser);
+void gnss_parser_feed(GnssParser *parser, GnssInfo *info, const uint8_t *buf, int length);
+int gnss_encode_poll(uint8_t *frame, uint8_t msg_class, uint8_t msg_id);
+
+#endif
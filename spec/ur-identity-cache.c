@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <ur-identity-cache.h>
+
+#define CACHE_FILE_SIZE (sizeof(IdentityCacheHeader) + IDENTITY_CACHE_SLOTS * sizeof(IdentityRecord))
+
+// Guards the mapping, probes look up and store from several workers
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static IdentityCacheHeader *cache_header = NULL;
+static IdentityRecord *cache_records = NULL;
+
+static uint32_t record_checksum(const IdentityRecord *record) {
+    const uint8_t *p = (const uint8_t *)record + sizeof(record->checksum);
+    const uint8_t *end = (const uint8_t *)record + sizeof(*record);
+    uint32_t hash = 2166136261u;
+    for (; p < end; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash ? hash : 1;
+}
+
+static bool record_valid(const IdentityRecord *record) {
+    return record->checksum != 0 && record->checksum == record_checksum(record);
+}
+
+static bool identity_equal(const UsbIdentity *a, const UsbIdentity *b) {
+    return a->vendor_id == b->vendor_id &&
+           a->product_id == b->product_id &&
+           a->interface == b->interface &&
+           strncmp(a->serial, b->serial, USB_SERIAL_LEN) == 0;
+}
+
+static void record_sync(IdentityRecord *record) {
+    long page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)record & ~(uintptr_t)(page - 1);
+    msync((void *)start, (uintptr_t)(record + 1) - start, MS_ASYNC);
+}
+
+// Maps the cache file, creating or rebuilding it when it doesn't match
+// this build. A cache that can't be opened is simply not used.
+bool identity_cache_open(const char *path) {
+    pthread_mutex_lock(&cache_mutex);
+    if (cache_header) {
+        pthread_mutex_unlock(&cache_mutex);
+        return true;
+    }
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        fprintf(stderr, "Identity cache %s unavailable: %s\n", path, strerror(errno));
+        pthread_mutex_unlock(&cache_mutex);
+        return false;
+    }
+
+    struct stat st;
+    bool fresh = fstat(fd, &st) < 0 || st.st_size != (off_t)CACHE_FILE_SIZE;
+    if (fresh && ftruncate(fd, CACHE_FILE_SIZE) < 0) {
+        fprintf(stderr, "Identity cache %s unavailable: %s\n", path, strerror(errno));
+        close(fd);
+        pthread_mutex_unlock(&cache_mutex);
+        return false;
+    }
+
+    void *map = mmap(NULL, CACHE_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Identity cache %s unavailable: %s\n", path, strerror(errno));
+        pthread_mutex_unlock(&cache_mutex);
+        return false;
+    }
+
+    IdentityCacheHeader *header = map;
+    if (fresh || header->magic != IDENTITY_CACHE_MAGIC ||
+        header->version != IDENTITY_CACHE_VERSION ||
+        header->record_size != sizeof(IdentityRecord) ||
+        header->slots != IDENTITY_CACHE_SLOTS) {
+        memset(map, 0, CACHE_FILE_SIZE);
+        header->version = IDENTITY_CACHE_VERSION;
+        header->record_size = sizeof(IdentityRecord);
+        header->slots = IDENTITY_CACHE_SLOTS;
+        // The magic goes last, a header torn by a crash is rebuilt
+        atomic_thread_fence(memory_order_release);
+        header->magic = IDENTITY_CACHE_MAGIC;
+        msync(map, CACHE_FILE_SIZE, MS_ASYNC);
+    }
+
+    cache_header = header;
+    cache_records = (IdentityRecord *)(header + 1);
+    pthread_mutex_unlock(&cache_mutex);
+
+    printf("Identity cache %s opened\n", path);
+    return true;
+}
+
+void identity_cache_close(void) {
+    pthread_mutex_lock(&cache_mutex);
+    if (cache_header) {
+        msync(cache_header, CACHE_FILE_SIZE, MS_SYNC);
+        munmap(cache_header, CACHE_FILE_SIZE);
+        cache_header = NULL;
+        cache_records = NULL;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+// Called with cache_mutex held
+static IdentityRecord *find_record(const UsbIdentity *key) {
+    for (int i = 0; i < IDENTITY_CACHE_SLOTS; i++) {
+        if (record_valid(&cache_records[i]) && identity_equal(&cache_records[i].key, key)) {
+            return &cache_records[i];
+        }
+    }
+    return NULL;
+}
+
+bool identity_cache_lookup(const UsbIdentity *key, ProbeResult *result) {
+    bool found = false;
+
+    if (!key->serial[0]) {
+        return false;
+    }
+    pthread_mutex_lock(&cache_mutex);
+    if (cache_records) {
+        IdentityRecord *record = find_record(key);
+        if (record) {
+            *result = record->result;
+            found = true;
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    return found;
+}
+
+// Inserts or replaces the entry for key, evicting the oldest when full
+void identity_cache_store(const UsbIdentity *key, const ProbeResult *result) {
+    if (!key->serial[0]) {
+        return;
+    }
+    pthread_mutex_lock(&cache_mutex);
+    if (!cache_records) {
+        pthread_mutex_unlock(&cache_mutex);
+        return;
+    }
+
+    IdentityRecord *record = find_record(key);
+    for (int i = 0; !record && i < IDENTITY_CACHE_SLOTS; i++) {
+        if (!record_valid(&cache_records[i])) {
+            record = &cache_records[i];
+        }
+    }
+    if (!record) {
+        record = &cache_records[0];
+        for (int i = 1; i < IDENTITY_CACHE_SLOTS; i++) {
+            if (cache_records[i].last_seen < record->last_seen) {
+                record = &cache_records[i];
+            }
+        }
+    }
+
+    // Invalidate, rewrite, then seal with the checksum
+    record->checksum = 0;
+    atomic_thread_fence(memory_order_release);
+    memset((uint8_t *)record + sizeof(record->checksum), 0,
+           sizeof(*record) - sizeof(record->checksum));
+    record->last_seen = (uint64_t)time(NULL);
+    record->key = *key;
+    record->result = *result;
+    atomic_thread_fence(memory_order_release);
+    record->checksum = record_checksum(record);
+    record_sync(record);
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+void identity_cache_forget(const UsbIdentity *key) {
+    pthread_mutex_lock(&cache_mutex);
+    if (cache_records) {
+        IdentityRecord *record = find_record(key);
+        if (record) {
+            record->checksum = 0;
+            record_sync(record);
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+}
@@ -0,0 +1,39 @@
+#ifndef __UR_IDENTITY_CACHE_H__
+#define __UR_IDENTITY_CACHE_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <ur-discovery.h>
+
+// On-disk map from a USB identity to the last probe result for it, so a
+// replugged autopilot can be routed before the handshake has run again.
+// The file is a header plus a fixed array of records, mapped shared and
+// updated in place. Every record carries a checksum over its contents and
+// is invalidated before being rewritten, so a crash or power loss in the
+// middle of an update costs at most that one entry.
+#define IDENTITY_CACHE_MAGIC 0x44495255 // "URID"
+#define IDENTITY_CACHE_VERSION 3
+#define IDENTITY_CACHE_SLOTS 64
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t record_size; // layout check, the file is rebuilt on mismatch
+    uint32_t slots;
+} IdentityCacheHeader;
+
+typedef struct {
+    uint32_t checksum; // FNV-1a over the rest of the record, 0 = free slot
+    uint32_t reserved;
+    uint64_t last_seen; // wall clock seconds, the oldest entry is evicted
+    UsbIdentity key;
+    ProbeResult result;
+} IdentityRecord;
+
+bool identity_cache_open(const char *path);
+void identity_cache_close(void);
+bool identity_cache_lookup(const UsbIdentity *key, ProbeResult *result);
+void identity_cache_store(const UsbIdentity *key, const ProbeResult *result);
+void identity_cache_forget(const UsbIdentity *key);
+
+#endif
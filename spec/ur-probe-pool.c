@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <time.h>
+#include <ur-probe-pool.h>
+
+#define job_of(entry) ((ProbeJob *)((char *)(entry) - offsetof(ProbeJob, timer)))
+
+// Everything below is guarded by pool_mutex
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond;   // run queue got a job, or stopping
+static pthread_cond_t timer_cond;  // wheel got an earlier timer, or stopping
+static bool pool_started = false;
+static bool pool_running = false;
+
+static pthread_t workers[MAX_PROBE_CONCURRENCY];
+static int worker_count = 0;
+static pthread_t timer_thread;
+static bool timer_started = false;
+
+static TimerWheel wheel;
+static ProbeJob *run_head = NULL;
+static ProbeJob *run_tail = NULL;
+static ProbeJob *wait_head = NULL;
+static ProbeJob *wait_tail = NULL;
+static int in_flight = 0;
+static int max_in_flight = DEFAULT_PROBES_IN_FLIGHT;
+
+// Milliseconds on the monotonic clock
+uint64_t probe_now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void queue_push(ProbeJob **head, ProbeJob **tail, ProbeJob *job) {
+    job->next = NULL;
+    if (*tail) {
+        (*tail)->next = job;
+    } else {
+        *head = job;
+    }
+    *tail = job;
+}
+
+static ProbeJob *queue_pop(ProbeJob **head, ProbeJob **tail) {
+    ProbeJob *job = *head;
+    if (job) {
+        *head = job->next;
+        if (!*head) {
+            *tail = NULL;
+        }
+        job->next = NULL;
+    }
+    return job;
+}
+
+// Behind every waiting job of the same or a higher priority
+static void wait_insert(ProbeJob *job) {
+    ProbeJob **link = &wait_head;
+
+    while (*link && (*link)->priority <= job->priority) {
+        link = &(*link)->next;
+    }
+    job->next = *link;
+    *link = job;
+    if (!job->next) {
+        wait_tail = job;
+    }
+}
+
+static void kick_locked(ProbeJob *job) {
+    if (!job->admitted || job->finished) {
+        return;
+    }
+    if (job->running) {
+        job->rerun = true;
+    } else if (!job->queued) {
+        job->queued = true;
+        queue_push(&run_head, &run_tail, job);
+        pthread_cond_signal(&work_cond);
+    }
+}
+
+static void admit_locked(void) {
+    while (in_flight < max_in_flight && wait_head) {
+        ProbeJob *job = queue_pop(&wait_head, &wait_tail);
+        job->admitted = true;
+        in_flight++;
+        kick_locked(job);
+    }
+}
+
+static void timer_fired(TimerWheelEntry *entry) {
+    kick_locked(job_of(entry));
+}
+
+static void *worker_loop(void *arg) {
+    pthread_mutex_lock(&pool_mutex);
+    while (1) {
+        while (pool_running && !run_head) {
+            pthread_cond_wait(&work_cond, &pool_mutex);
+        }
+        if (!pool_running) {
+            break;
+        }
+
+        ProbeJob *job = queue_pop(&run_head, &run_tail);
+        job->queued = false;
+        job->rerun = false;
+        job->running = true;
+        pthread_mutex_unlock(&pool_mutex);
+
+        job->step(job);
+
+        pthread_mutex_lock(&pool_mutex);
+        job->running = false;
+        if (job->finished) {
+            // The pool doesn't touch the job past this point, the owner may
+            // free or reuse it from on_finished
+            probe_finished_t on_finished = job->on_finished;
+            job->admitted = false;
+            in_flight--;
+            admit_locked();
+            if (on_finished) {
+                pthread_mutex_unlock(&pool_mutex);
+                on_finished(job);
+                pthread_mutex_lock(&pool_mutex);
+            }
+        } else if (job->rerun) {
+            kick_locked(job);
+        }
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    return NULL;
+}
+
+// Sleeps until the earliest pending timer and turns expiries into kicks
+static void *timer_loop(void *arg) {
+    pthread_mutex_lock(&pool_mutex);
+    while (pool_running) {
+        timer_wheel_advance(&wheel, probe_now_ms());
+
+        uint64_t next_ms;
+        if (timer_wheel_next_ms(&wheel, &next_ms)) {
+            struct timespec deadline = {
+                .tv_sec = next_ms / 1000,
+                .tv_nsec = (next_ms % 1000) * 1000000
+            };
+            pthread_cond_timedwait(&timer_cond, &pool_mutex, &deadline);
+        } else {
+            pthread_cond_wait(&timer_cond, &pool_mutex);
+        }
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    return NULL;
+}
+
+static int clamp(int value, int max) {
+    if (value < 1) {
+        return 1;
+    }
+    return value > max ? max : value;
+}
+
+bool probe_pool_start(int concurrency, int requested_in_flight) {
+    pthread_mutex_lock(&pool_mutex);
+    if (pool_started) {
+        pthread_mutex_unlock(&pool_mutex);
+        return true;
+    }
+
+    concurrency = clamp(concurrency, MAX_PROBE_CONCURRENCY);
+    max_in_flight = clamp(requested_in_flight, MAX_PROBES_IN_FLIGHT);
+
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&work_cond, NULL);
+    pthread_cond_init(&timer_cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    timer_wheel_init(&wheel, probe_now_ms());
+    pool_running = true;
+
+    // Probe steps are short and shallow, they don't need 8 MB stacks
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, PROBE_WORKER_STACK_SIZE);
+
+    timer_started = pthread_create(&timer_thread, &attr, timer_loop, NULL) == 0;
+    bool ok = timer_started;
+    for (worker_count = 0; ok && worker_count < concurrency; worker_count++) {
+        if (pthread_create(&workers[worker_count], &attr, worker_loop, NULL) != 0) {
+            ok = false;
+            break;
+        }
+    }
+    pthread_attr_destroy(&attr);
+    pool_started = true;
+    pthread_mutex_unlock(&pool_mutex);
+
+    if (!ok) {
+        fprintf(stderr, "Failed to start the probe pool\n");
+        probe_pool_stop();
+        return false;
+    }
+    printf("Probe pool started with %d workers, up to %d probes in flight\n", concurrency, max_in_flight);
+    return true;
+}
+
+// Waits for the steps in flight, unfinished probes are abandoned as they are
+void probe_pool_stop(void) {
+    pthread_mutex_lock(&pool_mutex);
+    if (!pool_started) {
+        pthread_mutex_unlock(&pool_mutex);
+        return;
+    }
+    pool_running = false;
+    pthread_cond_broadcast(&work_cond);
+    pthread_cond_broadcast(&timer_cond);
+    pthread_mutex_unlock(&pool_mutex);
+
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    if (timer_started) {
+        pthread_join(timer_thread, NULL);
+    }
+
+    pthread_mutex_lock(&pool_mutex);
+    run_head = run_tail = wait_head = wait_tail = NULL;
+    worker_count = 0;
+    timer_started = false;
+    in_flight = 0;
+    pool_started = false;
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+// Queues a new probe, its first step runs once an in-flight slot is free
+// and no job of a higher priority is waiting for one
+void probe_pool_submit(ProbeJob *job, probe_step_t step, probe_finished_t on_finished,
+                       ProbePriority priority) {
+    pthread_mutex_lock(&pool_mutex);
+    job->step = step;
+    job->on_finished = on_finished;
+    job->priority = priority;
+    job->next = NULL;
+    job->admitted = job->queued = job->running = job->rerun = job->finished = false;
+    timer_wheel_entry_init(&job->timer, timer_fired);
+    wait_insert(job);
+    admit_locked();
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+// Runs the job's step as soon as a worker is free, coalescing repeated kicks
+void probe_pool_kick(ProbeJob *job) {
+    pthread_mutex_lock(&pool_mutex);
+    kick_locked(job);
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+// Kicks the job at deadline_ms, replacing any deadline armed before
+void probe_pool_arm(ProbeJob *job, uint64_t deadline_ms) {
+    pthread_mutex_lock(&pool_mutex);
+    if (!job->finished) {
+        timer_wheel_add(&wheel, &job->timer, deadline_ms);
+        pthread_cond_signal(&timer_cond);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+// Called from the job's own step: no more steps, the slot is released
+// when the step returns
+void probe_pool_done(ProbeJob *job) {
+    pthread_mutex_lock(&pool_mutex);
+    job->finished = true;
+    timer_wheel_cancel(&wheel, &job->timer);
+    pthread_mutex_unlock(&pool_mutex);
+}
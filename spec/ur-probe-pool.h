@@ -0,0 +1,56 @@
+#ifndef __UR_PROBE_POOL_H__
+#define __UR_PROBE_POOL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <ur-timer-wheel.h>
+
+// Fixed-size executor for device probes. A probe is a ProbeJob whose step
+// function is run on one of the pool workers whenever the job is kicked
+// (data arrived) or its timer expires. Steps never block waiting for the
+// device, they act on what is there and arm the next deadline, so a probe
+// only needs a worker while a step runs. `concurrency` bounds the workers,
+// `in_flight` the probes between first step and done, which mostly wait on
+// their timer; later submissions wait their turn.
+#define DEFAULT_PROBE_CONCURRENCY 4
+#define MAX_PROBE_CONCURRENCY 32
+#define DEFAULT_PROBES_IN_FLIGHT 64
+#define MAX_PROBES_IN_FLIGHT 256
+#define PROBE_WORKER_STACK_SIZE (256 * 1024)
+
+// Order of admission, jobs of the same priority are admitted first come
+// first served
+typedef enum {
+    PROBE_PRIORITY_HIGH,
+    PROBE_PRIORITY_NORMAL,
+    PROBE_PRIORITY_LOW
+} ProbePriority;
+
+typedef struct ProbeJob ProbeJob;
+typedef void (*probe_step_t)(ProbeJob *job);
+typedef void (*probe_finished_t)(ProbeJob *job);
+
+struct ProbeJob {
+    probe_step_t step;
+    probe_finished_t on_finished; // after the pool let go of the job, may free it
+    TimerWheelEntry timer;
+    ProbeJob *next;  // run queue or admission queue
+    ProbePriority priority;
+    bool admitted;   // holds one of the in-flight slots
+    bool queued;     // on the run queue
+    bool running;    // a worker is inside step
+    bool rerun;      // kicked while running
+    bool finished;   // step called probe_pool_done
+};
+
+uint64_t probe_now_ms(void);
+
+bool probe_pool_start(int concurrency, int in_flight);
+void probe_pool_stop(void);
+void probe_pool_submit(ProbeJob *job, probe_step_t step, probe_finished_t on_finished,
+                       ProbePriority priority);
+void probe_pool_kick(ProbeJob *job);
+void probe_pool_arm(ProbeJob *job, uint64_t deadline_ms);
+void probe_pool_done(ProbeJob *job);
+
+#endif
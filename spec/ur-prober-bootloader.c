@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <string.h>
+#include <ur-discovery.h>
+#include <ur-event-outbox.h>
+
+// PX4/ArduPilot bootloader protocol: every command ends in EOC and is
+// answered with INSYNC, then OK or a failure code
+#define BL_INSYNC 0x12
+#define BL_OK 0x10
+#define BL_EOC 0x20
+#define BL_GET_SYNC 0x21
+#define BL_BOOT 0x30
+
+// Boards that enumerate under their own ids while in the bootloader
+static const struct {
+    uint16_t vendor_id;
+    uint16_t product_id;
+    const char *name;
+} bootloader_ids[] = {
+    {0x2DAE, 0x1001, "Cube Black Bootloader"},
+    {0x2DAE, 0x1002, "Cube Yellow Bootloader"},
+    {0x2DAE, 0x1005, "Cube Purple Bootloader"},
+};
+
+static const char *bootloader_name(const UsbIdentity *usb) {
+    for (size_t i = 0; i < sizeof(bootloader_ids) / sizeof(bootloader_ids[0]); i++) {
+        if (bootloader_ids[i].vendor_id == usb->vendor_id &&
+            bootloader_ids[i].product_id == usb->product_id) {
+            return bootloader_ids[i].name;
+        }
+    }
+    return NULL;
+}
+
+// Bootloaders only listen on the board's own USB port
+static bool bootloader_applies(const DeviceInfo *dev) {
+    return dev->usb.vendor_id != 0;
+}
+
+static ProberStatus bootloader_start(DeviceInfo *dev, uint64_t now) {
+    (void)now;
+    return bootloader_name(&dev->usb) ? PROBER_IDENTIFIED : PROBER_LISTENING;
+}
+
+static void bootloader_poke(DeviceInfo *dev, uint64_t now) {
+    static const uint8_t get_sync[] = { BL_GET_SYNC, BL_EOC };
+    (void)now;
+    cssl_putdata(dev->serial, (uint8_t *)get_sync, sizeof(get_sync));
+}
+
+// A bootloader never talks unasked, so the port must have sent nothing
+// but INSYNC/OK pairs. Any other byte rules it out for good, which keeps
+// a MAVLink stream that happens to carry 0x12 0x10 from passing.
+static ProberStatus bootloader_match(DeviceInfo *dev, const uint8_t *buf, int length) {
+    for (int i = 0; i < length && !dev->bootloader_foreign; i++) {
+        if (!dev->bootloader_pending && buf[i] == BL_INSYNC) {
+            dev->bootloader_pending = buf[i];
+        } else if (dev->bootloader_pending && buf[i] == BL_OK) {
+            dev->bootloader_pending = 0;
+            dev->bootloader_replies++;
+        } else {
+            dev->bootloader_foreign = true;
+        }
+    }
+    return !dev->bootloader_foreign && dev->bootloader_replies ? PROBER_IDENTIFIED : PROBER_LISTENING;
+}
+
+static void bootloader_detected(DeviceInfo *dev, uint64_t now) {
+    static const uint8_t boot[] = { BL_BOOT, BL_EOC };
+    (void)now;
+
+    printf("Device %s is in its bootloader, waiting for the application port\n", dev->path);
+    // Our sync stopped the bootloader's countdown to the application,
+    // start it right away instead
+    if (dev->serial) {
+        cssl_putdata(dev->serial, (uint8_t *)boot, sizeof(boot));
+    }
+}
+
+static void bootloader_publish(DeviceInfo *dev) {
+    const char *name = bootloader_name(&dev->usb);
+    char json[DEV_PATH_LEN + 256];
+
+    snprintf(json, sizeof(json),
+             "{\"event\":\"bootloader\",\"dev_path\":\"%s\",\"state\":\"waiting\","
+             "\"detected_by\":\"%s\",\"name\":\"%s\",\"vendor_id\":%u,\"product_id\":%u}",
+             dev->path, name ? "usb-id" : "sync", name ? name : "Unknown",
+             dev->usb.vendor_id, dev->usb.product_id);
+    outbox_publish(DISCOVERY_STATUS_TOPIC, json);
+    expect_application_port(&dev->usb);
+}
+
+// PX4/ArduPilot bootloaders: known USB ids, or an answer to GET_SYNC
+const Prober bootloader_prober = {
+    .name = "bootloader",
+    .collect_timeout_ms = 0,
+    .applies = bootloader_applies,
+    .start = bootloader_start,
+    .poke = bootloader_poke,
+    .match = bootloader_match,
+    .detected = bootloader_detected,
+    .publish = bootloader_publish,
+};
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <string.h>
+#include <ur-discovery.h>
+#include <ur-event-outbox.h>
+
+#define UBLOX_USB_VENDOR_ID 0x1546
+
+// u-blox receivers on their own USB port, by product id
+static const char *ublox_usb_model(uint16_t product_id) {
+    switch (product_id) {
+        case 0x01a5: return "u-blox 5";
+        case 0x01a6: return "u-blox 6";
+        case 0x01a7: return "u-blox 7";
+        case 0x01a8: return "u-blox 8";
+        case 0x01a9: return "u-blox 9";
+        default: return NULL;
+    }
+}
+
+static void send_version_poll(cssl_t *serial) {
+    uint8_t frame[8];
+    int len = gnss_encode_poll(frame, UBX_CLASS_MON, UBX_ID_MON_VER);
+    cssl_putdata(serial, frame, len);
+}
+
+static void gnss_poke(DeviceInfo *dev, uint64_t now) {
+    (void)now;
+    send_version_poll(dev->serial);
+}
+
+static ProberStatus gnss_match(DeviceInfo *dev, const uint8_t *buf, int length) {
+    gnss_parser_feed(&dev->gnss_parser, &dev->gnss, buf, length);
+
+    if (dev->gnss.version_received) {
+        return PROBER_IDENTIFIED;
+    }
+    if (dev->gnss.nmea_sentences + dev->gnss.ubx_frames >= GNSS_DETECT_FRAMES) {
+        return PROBER_DETECTED;
+    }
+    return PROBER_LISTENING;
+}
+
+static void gnss_resync(DeviceInfo *dev) {
+    gnss_parser_resync(&dev->gnss_parser);
+}
+
+static void gnss_detected(DeviceInfo *dev, uint64_t now) {
+    (void)now;
+    printf("Device %s is a GNSS receiver at %d baud - querying version...\n", dev->path, dev->baud);
+    send_version_poll(dev->serial);
+}
+
+static void gnss_publish(DeviceInfo *dev) {
+    GnssInfo *info = &dev->gnss;
+    const char *protocols = info->nmea_sentences && info->ubx_frames ? "nmea+ubx" :
+                            info->ubx_frames ? "ubx" : "nmea";
+    char json[768];
+
+    // The adapter tells what the receiver didn't
+    if (dev->usb.vendor_id == UBLOX_USB_VENDOR_ID) {
+        const char *model = ublox_usb_model(dev->usb.product_id);
+        if (!info->vendor[0]) {
+            strcpy(info->vendor, "u-blox");
+        }
+        if (!info->model[0] && model) {
+            strcpy(info->model, model);
+        }
+    }
+
+    printf("\nGNSS Device Information for %s:\n", dev->path);
+    printf("  Vendor: %s\n", info->vendor[0] ? info->vendor : "Unknown");
+    printf("  Model: %s\n", info->model[0] ? info->model : "Unknown");
+    printf("  Baud Rate: %d\n", dev->baud);
+    printf("  Protocols: %s\n", protocols);
+    if (info->talker[0]) {
+        printf("  Talker: %s\n", info->talker);
+    }
+    if (info->version_received || info->hw_version[0]) {
+        printf("  SW Version: %s\n", info->sw_version);
+        printf("  HW Version: %s\n", info->hw_version);
+        printf("  FW Version: %s\n", info->fw_version);
+        printf("  Protocol Version: %s\n", info->protocol_version);
+    }
+
+    snprintf(json, sizeof(json),
+             "{\"event\":\"gnss\",\"dev_path\":\"%s\",\"baud\":%d,\"protocols\":\"%s\","
+             "\"talker\":\"%s\",\"vendor\":\"%s\",\"model\":\"%s\",\"sw_version\":\"%s\","
+             "\"hw_version\":\"%s\",\"fw_version\":\"%s\",\"protocol_version\":\"%s\","
+             "\"version_received\":%s}",
+             dev->path, dev->baud, protocols, info->talker, info->vendor, info->model,
+             info->sw_version, info->hw_version, info->fw_version, info->protocol_version,
+             info->version_received ? "true" : "false");
+    outbox_publish(DISCOVERY_STATUS_TOPIC, json);
+}
+
+// Plain NMEA receivers have no version to poll, they go out as they are
+static void gnss_expired(DeviceInfo *dev) {
+    printf("No version answer from GNSS receiver on %s\n", dev->path);
+    gnss_publish(dev);
+}
+
+// NMEA and UBX receivers: sentences or frames, then the UBX MON-VER poll
+const Prober gnss_prober = {
+    .name = "gnss",
+    .collect_timeout_ms = GNSS_VERSION_TIMEOUT_MS,
+    .poke = gnss_poke,
+    .match = gnss_match,
+    .resync = gnss_resync,
+    .detected = gnss_detected,
+    .publish = gnss_publish,
+    .expired = gnss_expired,
+};
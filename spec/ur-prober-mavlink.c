@@ -0,0 +1,240 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <libmavlink.h>
+#include <ur-discovery.h>
+#include <ur-identity-cache.h>
+
+// A reflashed board reports other versions or, for a swapped board behind
+// the same adapter, another uid; its cache entry no longer applies
+static bool firmware_changed(const PX4DeviceInfo *cached, const PX4DeviceInfo *fresh) {
+    return cached->flight_sw_version != fresh->flight_sw_version ||
+           cached->middleware_sw_version != fresh->middleware_sw_version ||
+           cached->os_sw_version != fresh->os_sw_version ||
+           cached->board_version != fresh->board_version ||
+           memcmp(cached->flight_custom_version, fresh->flight_custom_version, 8) != 0 ||
+           memcmp(cached->middleware_custom_version, fresh->middleware_custom_version, 8) != 0 ||
+           memcmp(cached->os_custom_version, fresh->os_custom_version, 8) != 0 ||
+           strcmp(cached->uid, fresh->uid) != 0;
+}
+
+static ProberStatus mavlink_start(DeviceInfo *dev, uint64_t now) {
+    if (!dev->cache_hit) {
+        return PROBER_LISTENING;
+    }
+    // Seen before: route it right away, the probe confirms the entry or
+    // withdraws it. Done before the port opens, so nothing the decoder
+    // writes is raced.
+    dev->px4_info = dev->cached.px4_info;
+    dev->sysid = dev->cached.sysid;
+    dev->compid = dev->cached.compid;
+    dev->mavlink_version = dev->cached.mavlink_version;
+    dev->dialect = dev->cached.dialect;
+    dev->info_from_cache = true;
+    printf("Known device on %s, routing from cache at %d baud\n", dev->path, dev->cached.baud);
+    register_device_mavrouter(dev->path);
+    dev->registered = true;
+    dev->registered_ms = now;
+    print_px4_device_info(dev);
+    return PROBER_LISTENING;
+}
+
+// Broadcast, until a heartbeat tells whom to ask; encoded once in either
+// framing
+static MavlinkHandshake broadcast_handshake;
+static MavlinkHandshake broadcast_handshake_v1;
+static pthread_once_t broadcast_once = PTHREAD_ONCE_INIT;
+
+static void encode_broadcast_handshake(void) {
+    mavlink_handshake_encode(&broadcast_handshake, 0, 0, false, false);
+    mavlink_handshake_encode(&broadcast_handshake_v1, 0, 0, false, true);
+}
+
+// MAVLink 2 first, which MAVLink-1-only firmware drops, so after a few
+// unanswered tries every other broadcast falls back to 0xFE framing. Once
+// a heartbeat is in, the handshake follows the device's framing.
+static void mavlink_poke(DeviceInfo *dev, uint64_t now) {
+    bool mavlink1 = dev->mavlink_pokes >= MAVLINK_V1_AFTER &&
+                    (dev->mavlink_pokes - MAVLINK_V1_AFTER) % 2 == 0;
+    const MavlinkHandshake *handshake = mavlink1 ? &broadcast_handshake_v1 : &broadcast_handshake;
+
+    (void)now;
+    pthread_once(&broadcast_once, encode_broadcast_handshake);
+    cssl_putdata(dev->serial, (uint8_t *)handshake->buf, handshake->len);
+    dev->mavlink_pokes++;
+}
+
+// ArduPilot's own messages only check out with ardupilotmega's CRC_EXTRA
+// and settle it; otherwise the heartbeat's autopilot type tells PX4 from
+// the rest, which speak common
+static void observe_dialect(DeviceInfo *dev, const mavlink_message_t *msg) {
+    if (libmavlink_ardupilotmega_message(msg->msgid)) {
+        dev->dialect = MAVLINK_DIALECT_ARDUPILOTMEGA;
+        return;
+    }
+    if (msg->msgid == MAVLINK_MSG_ID_HEARTBEAT) {
+        switch (mavlink_msg_heartbeat_get_autopilot(msg)) {
+            case MAV_AUTOPILOT_ARDUPILOTMEGA:
+                dev->dialect = MAVLINK_DIALECT_ARDUPILOTMEGA;
+                return;
+            case MAV_AUTOPILOT_PX4:
+                dev->dialect = MAVLINK_DIALECT_PX4;
+                return;
+            default:
+                break;
+        }
+    }
+    if (dev->dialect == MAVLINK_DIALECT_UNKNOWN) {
+        dev->dialect = MAVLINK_DIALECT_COMMON;
+    }
+}
+
+// Bytes are decoded without holding any lock, the parser and the flags
+// are the decoder's own
+static ProberStatus mavlink_match(DeviceInfo *dev, const uint8_t *buf, int length) {
+    mavlink_message_t msg;
+    mavlink_status_t status;
+    int pos = 0;
+
+    while (pos < length) {
+        if (!libmavlink_parse_buffer(&dev->parser, buf, length, &pos, &msg, &status)) {
+            continue;
+        }
+        dev->mavlink_version = (status.flags & MAVLINK_STATUS_FLAG_IN_MAVLINK1) ? 1 : 2;
+        observe_dialect(dev, &msg);
+        switch (msg.msgid) {
+            case MAVLINK_MSG_ID_HEARTBEAT:
+                if (!dev->heartbeat_received) {
+                    printf("MAVLink heartbeat received from %s\n", dev->path);
+                    dev->sysid = msg.sysid;
+                    dev->compid = msg.compid;
+                    dev->heartbeat_received = true;
+                    dev->mavlink_valid = true;
+                }
+                break;
+
+            case MAVLINK_MSG_ID_AUTOPILOT_VERSION:
+                // May beat the heartbeat, the broadcast asks for both
+                if (!dev->info_collected) {
+                    if (!dev->mavlink_valid) {
+                        dev->sysid = msg.sysid;
+                        dev->compid = msg.compid;
+                        dev->mavlink_valid = true;
+                    }
+                    process_autopilot_version(&msg, dev);
+                    dev->info_collected = true;
+                }
+                break;
+
+            case MAVLINK_MSG_ID_PROTOCOL_VERSION:
+                if (!dev->protocol_version) {
+                    mavlink_protocol_version_t version;
+                    mavlink_msg_protocol_version_decode(&msg, &version);
+                    dev->protocol_version = version.version;
+                    dev->min_protocol_version = version.min_version;
+                    dev->max_protocol_version = version.max_version;
+                }
+                break;
+
+            case MAVLINK_MSG_ID_COMMAND_ACK:
+                if (mavlink_msg_command_ack_get_command(&msg) == MAV_CMD_REQUEST_MESSAGE &&
+                    mavlink_msg_command_ack_get_result(&msg) != MAV_RESULT_ACCEPTED) {
+                    atomic_store(&dev->request_refused, true);
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    // The heartbeat's autopilot type settles the dialect, so it has to be
+    // in too; mavlink_expired publishes without it
+    if (dev->info_collected && dev->heartbeat_received) {
+        return PROBER_IDENTIFIED;
+    }
+    return dev->mavlink_valid ? PROBER_DETECTED : PROBER_LISTENING;
+}
+
+static void mavlink_resync(DeviceInfo *dev) {
+    libmavlink_parser_resync(&dev->parser);
+}
+
+static void mavlink_detected(DeviceInfo *dev, uint64_t now) {
+    bool mavlink1 = dev->mavlink_version == 1;
+
+    printf("Device %s is MAVLink compatible at %d baud (sysid %u, compid %u, MAVLink %d)\n",
+           dev->path, dev->baud, dev->sysid, dev->compid, mavlink1 ? 1 : 2);
+    // The heartbeat told whom to ask and in which framing, no need to
+    // broadcast from here on
+    mavlink_handshake_encode(&dev->handshake, dev->sysid, dev->compid, false, mavlink1);
+    mavlink_handshake_encode(&dev->fallback, dev->sysid, dev->compid, true, mavlink1);
+    dev->info_requests = 0;
+    if (!dev->registered) {
+        register_device_mavrouter(dev->path);
+        dev->registered = true;
+        dev->registered_ms = now;
+    }
+}
+
+// Asks again with a doubling delay, adding the older command once the
+// request went unanswered a few times or was refused outright
+static uint64_t mavlink_retry(DeviceInfo *dev, uint64_t now) {
+    bool fallback = dev->info_requests >= MAVLINK_FALLBACK_AFTER || atomic_load(&dev->request_refused);
+    const MavlinkHandshake *handshake = fallback ? &dev->fallback : &dev->handshake;
+    long delay_ms = (long)MAVLINK_RETRY_INITIAL_MS << (dev->info_requests < 4 ? dev->info_requests : 4);
+
+    if (dev->info_requests && !dev->info_collected) {
+        printf("No device info from %s yet, asking again%s\n",
+               dev->path, fallback ? " with MAV_CMD_REQUEST_AUTOPILOT_CAPABILITIES" : "");
+    }
+    cssl_putdata(dev->serial, (uint8_t *)handshake->buf, handshake->len);
+    dev->info_requests++;
+    return now + (delay_ms < MAVLINK_RETRY_MAX_MS ? delay_ms : MAVLINK_RETRY_MAX_MS);
+}
+
+static void mavlink_publish(DeviceInfo *dev) {
+    bool unchanged = dev->info_from_cache &&
+                     !firmware_changed(&dev->cached.px4_info, &dev->px4_info);
+    dev->info_from_cache = false;
+    if (unchanged) {
+        printf("Cached identity of %s confirmed\n", dev->path);
+    } else {
+        print_px4_device_info(dev);
+    }
+
+    // Replaces the entry when the firmware changed
+    ProbeResult result = {
+        .baud = dev->baud,
+        .sysid = dev->sysid,
+        .compid = dev->compid,
+        .mavlink_version = dev->mavlink_version,
+        .dialect = dev->dialect,
+        .px4_info = dev->px4_info,
+    };
+    identity_cache_store(&dev->usb, &result);
+}
+
+// AUTOPILOT_VERSION came without a heartbeat, the dialect is a guess
+static void mavlink_expired(DeviceInfo *dev) {
+    if (dev->info_collected) {
+        printf("No heartbeat from %s, publishing without it\n", dev->path);
+        mavlink_publish(dev);
+    } else {
+        printf("Timeout waiting for mavlink device info from %s\n", dev->path);
+    }
+}
+
+// MAVLink v1/v2 autopilots: heartbeat, then AUTOPILOT_VERSION
+const Prober mavlink_prober = {
+    .name = "mavlink",
+    .collect_timeout_ms = INFO_COLLECTION_TIMEOUT_MS,
+    .start = mavlink_start,
+    .poke = mavlink_poke,
+    .retry = mavlink_retry,
+    .match = mavlink_match,
+    .resync = mavlink_resync,
+    .detected = mavlink_detected,
+    .publish = mavlink_publish,
+    .expired = mavlink_expired,
+};
@@ -0,0 +1,199 @@
+#include <string.h>
+#include <ur-stream-classifier.h>
+
+enum {
+    RTCM_PREAMBLE,
+    RTCM_LEN1,
+    RTCM_LEN2,
+    RTCM_PAYLOAD,
+    RTCM_CRC1,
+    RTCM_CRC2,
+    RTCM_CRC3
+};
+
+#define CRC24Q_POLY 0x1864CFB
+#define STREAM_STX_V1 0xFE
+#define STREAM_STX_V2 0xFD
+
+void stream_classifier_init(StreamClassifier *classifier) {
+    memset(classifier, 0, sizeof(*classifier));
+}
+
+// Drops partial frames, the counters stay
+void stream_classifier_resync(StreamClassifier *classifier) {
+    gnss_framer_resync(&classifier->gnss);
+    classifier->rtcm_state = RTCM_PREAMBLE;
+    classifier->at_len = 0;
+}
+
+static uint32_t crc24q_update(uint32_t crc, uint8_t byte) {
+    crc ^= (uint32_t)byte << 16;
+    for (int i = 0; i < 8; i++) {
+        crc <<= 1;
+        if (crc & 0x1000000) {
+            crc ^= CRC24Q_POLY;
+        }
+    }
+    return crc & 0xFFFFFF;
+}
+
+static void feed_rtcm(StreamClassifier *c, uint8_t byte) {
+    switch (c->rtcm_state) {
+    case RTCM_PREAMBLE:
+        if (byte == 0xD3) {
+            c->rtcm_crc = crc24q_update(0, byte);
+            c->rtcm_state = RTCM_LEN1;
+        }
+        return;
+    case RTCM_LEN1:
+        // Six reserved bits, always zero
+        if (byte & 0xFC) {
+            c->rtcm_state = RTCM_PREAMBLE;
+            return;
+        }
+        c->rtcm_crc = crc24q_update(c->rtcm_crc, byte);
+        c->rtcm_len = (uint16_t)(byte & 0x03) << 8;
+        c->rtcm_state = RTCM_LEN2;
+        return;
+    case RTCM_LEN2:
+        c->rtcm_crc = crc24q_update(c->rtcm_crc, byte);
+        c->rtcm_len |= byte;
+        c->rtcm_pos = 0;
+        c->rtcm_state = c->rtcm_len ? RTCM_PAYLOAD : RTCM_CRC1;
+        return;
+    case RTCM_PAYLOAD:
+        c->rtcm_crc = crc24q_update(c->rtcm_crc, byte);
+        if (++c->rtcm_pos == c->rtcm_len) {
+            c->rtcm_state = RTCM_CRC1;
+        }
+        return;
+    case RTCM_CRC1:
+        c->rtcm_state = byte == ((c->rtcm_crc >> 16) & 0xFF) ? RTCM_CRC2 : RTCM_PREAMBLE;
+        return;
+    case RTCM_CRC2:
+        c->rtcm_state = byte == ((c->rtcm_crc >> 8) & 0xFF) ? RTCM_CRC3 : RTCM_PREAMBLE;
+        return;
+    case RTCM_CRC3:
+        if (byte == (c->rtcm_crc & 0xFF)) {
+            atomic_fetch_add_explicit(&c->counters.rtcm, 1, memory_order_relaxed);
+        }
+        c->rtcm_state = RTCM_PREAMBLE;
+        return;
+    }
+}
+
+// Result codes and echoes a modem in command mode produces
+static bool at_line(const char *line) {
+    static const char *const exact[] = {
+        "OK", "ERROR", "RING", "NO CARRIER", "NO DIALTONE", "BUSY", "NO ANSWER"
+    };
+    static const char *const prefixes[] = {
+        "AT", "CONNECT", "+C", "+Q", "^"
+    };
+
+    for (size_t i = 0; i < sizeof(exact) / sizeof(exact[0]); i++) {
+        if (strcmp(line, exact[i]) == 0) {
+            return true;
+        }
+    }
+    for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
+        if (strncmp(line, prefixes[i], strlen(prefixes[i])) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void feed_at(StreamClassifier *c, uint8_t byte) {
+    if (byte == '\r' || byte == '\n') {
+        c->at_line[c->at_len] = '\0';
+        if (c->at_len && at_line(c->at_line)) {
+            atomic_fetch_add_explicit(&c->counters.at, 1, memory_order_relaxed);
+        }
+        c->at_len = 0;
+    } else if (byte < 0x20 || byte > 0x7e) {
+        // Binary in between, whatever this line was it isn't a modem's.
+        // Parked at the limit until the next line end.
+        c->at_len = AT_MAX_LINE;
+    } else if (c->at_len < AT_MAX_LINE) {
+        c->at_line[c->at_len++] = (char)byte;
+    }
+}
+
+void stream_classifier_feed(StreamClassifier *classifier, const uint8_t *buf, int length) {
+    unsigned int stx = 0;
+
+    for (int i = 0; i < length; i++) {
+        uint8_t byte = buf[i];
+        stx += (byte == STREAM_STX_V1 || byte == STREAM_STX_V2);
+        unsigned int frames = gnss_framer_feed(&classifier->gnss, byte, NULL, 0);
+        if (frames & GNSS_FRAME_NMEA) {
+            atomic_fetch_add_explicit(&classifier->counters.nmea, 1, memory_order_relaxed);
+        }
+        if (frames & GNSS_FRAME_UBX) {
+            atomic_fetch_add_explicit(&classifier->counters.ubx, 1, memory_order_relaxed);
+        }
+        feed_rtcm(classifier, byte);
+        feed_at(classifier, byte);
+    }
+    atomic_fetch_add_explicit(&classifier->counters.bytes, length, memory_order_relaxed);
+    atomic_fetch_add_explicit(&classifier->counters.stx, stx, memory_order_relaxed);
+}
+
+void stream_classifier_snapshot(const StreamClassifier *classifier, StreamSnapshot *snapshot) {
+    snapshot->bytes = atomic_load(&classifier->counters.bytes);
+    snapshot->stx = atomic_load(&classifier->counters.stx);
+    snapshot->nmea = atomic_load(&classifier->counters.nmea);
+    snapshot->ubx = atomic_load(&classifier->counters.ubx);
+    snapshot->rtcm = atomic_load(&classifier->counters.rtcm);
+    snapshot->at = atomic_load(&classifier->counters.at);
+}
+
+// What the port has been sending since the snapshot. mavlink_frames are
+// the good MAVLink frames decoded over the same stretch: one is enough to
+// keep probing, checksummed frames of another protocol are conclusive the
+// other way.
+StreamKind stream_classify(const StreamClassifier *classifier, const StreamSnapshot *since,
+                           unsigned int mavlink_frames) {
+    StreamSnapshot now;
+
+    if (mavlink_frames) {
+        return STREAM_MAVLINK;
+    }
+    stream_classifier_snapshot(classifier, &now);
+    if (now.ubx - since->ubx >= STREAM_FOREIGN_FRAMES) {
+        return STREAM_UBX;
+    }
+    if (now.rtcm - since->rtcm >= STREAM_FOREIGN_FRAMES) {
+        return STREAM_RTCM;
+    }
+    if (now.nmea - since->nmea >= STREAM_FOREIGN_FRAMES) {
+        return STREAM_NMEA;
+    }
+    if (now.at - since->at >= STREAM_FOREIGN_FRAMES) {
+        return STREAM_AT;
+    }
+    if (now.bytes - since->bytes >= STREAM_NOISE_BYTES) {
+        return STREAM_NOISE;
+    }
+    return STREAM_UNKNOWN;
+}
+
+const char *stream_kind_name(StreamKind kind) {
+    switch (kind) {
+    case STREAM_MAVLINK:
+        return "mavlink";
+    case STREAM_NMEA:
+        return "nmea";
+    case STREAM_UBX:
+        return "ubx";
+    case STREAM_RTCM:
+        return "rtcm3";
+    case STREAM_AT:
+        return "at-modem";
+    case STREAM_NOISE:
+        return "unrecognised";
+    default:
+        return "unknown";
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef __UR_STREAM_CLASSIFIER_H__
+#define __UR_STREAM_CLASSIFIER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <ur-gnss-framer.h>
+
+// Recognises what a port is talking when it isn't MAVLink, so the probe can
+// give up on it early. The classifier runs alongside the MAVLink parser on
+// the decoder thread and counts complete, checksummed frames of the
+// protocols commonly found on the same kind of ports: NMEA and UBX from
+// GNSS receivers, RTCM3 correction streams and AT-command modems. The
+// counters only ever grow, a probe judges the difference since the start
+// of its baud window.
+#define AT_MAX_LINE 64
+// Frames needed before a foreign protocol is believed
+#define STREAM_FOREIGN_FRAMES 2
+// This many bytes without a single MAVLink frame is not MAVLink at this
+// rate: even the longest v2 frame is 280 bytes
+#define STREAM_NOISE_BYTES 1024
+
+typedef enum {
+    STREAM_UNKNOWN, // not enough evidence yet
+    STREAM_MAVLINK,
+    STREAM_NMEA,
+    STREAM_UBX,
+    STREAM_RTCM,
+    STREAM_AT,
+    STREAM_NOISE    // plenty of bytes, nothing recognisable
+} StreamKind;
+
+typedef struct {
+    atomic_uint bytes;
+    atomic_uint stx; // MAVLink v1/v2 start bytes
+    atomic_uint nmea;
+    atomic_uint ubx;
+    atomic_uint rtcm;
+    atomic_uint at;
+} StreamCounters;
+
+typedef struct {
+    unsigned int bytes;
+    unsigned int stx;
+    unsigned int nmea;
+    unsigned int ubx;
+    unsigned int rtcm;
+    unsigned int at;
+} StreamSnapshot;
+
+// Owned by the decoder thread, except for the counters
+typedef struct {
+    StreamCounters counters;
+    // NMEA and UBX, shared with the GNSS parser
+    GnssFramer gnss;
+    // RTCM3: D3 len10 payload crc24q
+    int rtcm_state;
+    uint16_t rtcm_len;
+    uint16_t rtcm_pos;
+    uint32_t rtcm_crc;
+    // AT: text lines
+    char at_line[AT_MAX_LINE + 1];
+    int at_len;
+} StreamClassifier;
+
+void stream_classifier_init(StreamClassifier *classifier);
+void stream_classifier_resync(StreamClassifier *classifier);
+void stream_classifier_feed(StreamClassifier *classifier, const uint8_t *buf, int length);
+void stream_classifier_snapshot(const StreamClassifier *classifier, StreamSnapshot *snapshot);
+StreamKind stream_classify(const StreamClassifier *classifier, const StreamSnapshot *since,
+                           unsigned int mavlink_frames);
+const char *stream_kind_name(StreamKind kind);
+
+#endif
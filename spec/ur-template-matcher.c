@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ur-template-matcher.h>
+
+void glob_set_init(GlobSet *set) {
+    memset(set, 0, sizeof(*set));
+}
+
+void glob_set_free(GlobSet *set) {
+    free(set->states);
+    free(set->classes);
+    glob_set_init(set);
+}
+
+bool glob_set_empty(const GlobSet *set) {
+    return set->state_count == 0;
+}
+
+static bool push_state(GlobSet *set, GlobOp op, uint8_t ch, uint16_t arg) {
+    if (set->state_count == GLOB_MAX_STATES) {
+        return false;
+    }
+    if (set->state_count == set->state_capacity) {
+        int capacity = set->state_capacity ? set->state_capacity * 2 : 64;
+        GlobState *states = realloc(set->states, capacity * sizeof(GlobState));
+        if (!states) {
+            return false;
+        }
+        set->states = states;
+        set->state_capacity = capacity;
+    }
+    set->states[set->state_count++] = (GlobState){ .op = op, .ch = ch, .arg = arg };
+    return true;
+}
+
+static int push_class(GlobSet *set, const uint8_t bits[32]) {
+    uint8_t (*classes)[32] = realloc(set->classes, (set->class_count + 1) * sizeof(*classes));
+    if (!classes || set->class_count == UINT16_MAX) {
+        return -1;
+    }
+    set->classes = classes;
+    memcpy(set->classes[set->class_count], bits, 32);
+    return set->class_count++;
+}
+
+// Parses the class opening at *p, leaves *p past the closing ']'
+static bool parse_class(const char **p, uint8_t bits[32]) {
+    const char *s = *p + 1;
+    bool negate = false;
+
+    memset(bits, 0, 32);
+    if (*s == '!' || *s == '^') {
+        negate = true;
+        s++;
+    }
+    // A ']' right at the start is a member, not the end
+    bool first = true;
+    while (*s && (*s != ']' || first)) {
+        uint8_t lo = (uint8_t)*s++;
+        if (lo == '\\' && *s) {
+            lo = (uint8_t)*s++;
+        }
+        uint8_t hi = lo;
+        if (s[0] == '-' && s[1] && s[1] != ']') {
+            s++;
+            hi = (uint8_t)*s++;
+            if (hi == '\\' && *s) {
+                hi = (uint8_t)*s++;
+            }
+        }
+        for (int c = lo; c <= hi; c++) {
+            bits[c >> 3] |= 1 << (c & 7);
+        }
+        first = false;
+    }
+    if (*s != ']') {
+        return false;
+    }
+    if (negate) {
+        for (int i = 0; i < 32; i++) {
+            bits[i] = ~bits[i];
+        }
+    }
+    bits[0] &= ~1; // never matches the terminator
+    *p = s + 1;
+    return true;
+}
+
+static void enter(const GlobSet *set, uint64_t *active, int state) {
+    // A star may match nothing, what follows it is active too
+    while (set->states[state].op == GLOB_STAR) {
+        active[state >> 6] |= (uint64_t)1 << (state & 63);
+        state++;
+    }
+    active[state >> 6] |= (uint64_t)1 << (state & 63);
+}
+
+// Compiles pattern and adds it under rule. On a syntax error or when the
+// set is full nothing is added.
+bool glob_set_add(GlobSet *set, const char *pattern, int rule) {
+    int first = set->state_count;
+    int class_count = set->class_count;
+    const char *p = pattern;
+    bool ok = rule >= 0 && rule < GLOB_MAX_RULES;
+
+    while (ok && *p) {
+        uint8_t bits[32];
+        int cls;
+
+        switch (*p) {
+        case '*':
+            // Runs of stars are one star
+            if (set->state_count == first || set->states[set->state_count - 1].op != GLOB_STAR) {
+                ok = push_state(set, GLOB_STAR, 0, 0);
+            }
+            p++;
+            break;
+        case '?':
+            ok = push_state(set, GLOB_ANY, 0, 0);
+            p++;
+            break;
+        case '[':
+            ok = parse_class(&p, bits) && (cls = push_class(set, bits)) >= 0 &&
+                 push_state(set, GLOB_CLASS, 0, (uint16_t)cls);
+            break;
+        case '\\':
+            if (p[1]) {
+                p++;
+            }
+            // fall through
+        default:
+            ok = push_state(set, GLOB_CHAR, (uint8_t)*p, 0);
+            p++;
+            break;
+        }
+    }
+    ok = ok && push_state(set, GLOB_ACCEPT, 0, (uint16_t)rule);
+
+    if (!ok) {
+        set->state_count = first;
+        set->class_count = class_count;
+        return false;
+    }
+    enter(set, set->initial, first);
+    return true;
+}
+
+// Mask of the rules whose pattern matches all of name, one pass over it
+uint64_t glob_set_match(const GlobSet *set, const char *name) {
+    uint64_t current[GLOB_WORDS], next[GLOB_WORDS];
+    int words = (set->state_count + 63) / 64;
+    uint64_t rules = 0;
+
+    if (!words) {
+        return 0;
+    }
+    memcpy(current, set->initial, words * sizeof(uint64_t));
+
+    for (const uint8_t *c = (const uint8_t *)name; *c; c++) {
+        uint64_t any = 0;
+        memset(next, 0, words * sizeof(uint64_t));
+        for (int w = 0; w < words; w++) {
+            for (uint64_t bits = current[w]; bits; bits &= bits - 1) {
+                int state = w * 64 + __builtin_ctzll(bits);
+                const GlobState *s = &set->states[state];
+                switch (s->op) {
+                case GLOB_CHAR:
+                    if (s->ch == *c) {
+                        enter(set, next, state + 1);
+                    }
+                    break;
+                case GLOB_ANY:
+                    enter(set, next, state + 1);
+                    break;
+                case GLOB_CLASS:
+                    if (set->classes[s->arg][*c >> 3] & (1 << (*c & 7))) {
+                        enter(set, next, state + 1);
+                    }
+                    break;
+                case GLOB_STAR:
+                    enter(set, next, state);
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+        for (int w = 0; w < words; w++) {
+            current[w] = next[w];
+            any |= next[w];
+        }
+        // Nothing left that could match, most names end here early
+        if (!any) {
+            return 0;
+        }
+    }
+
+    for (int w = 0; w < words; w++) {
+        for (uint64_t bits = current[w]; bits; bits &= bits - 1) {
+            const GlobState *s = &set->states[w * 64 + __builtin_ctzll(bits)];
+            if (s->op == GLOB_ACCEPT) {
+                rules |= (uint64_t)1 << s->arg;
+            }
+        }
+    }
+    return rules;
+}
@@ -0,0 +1,46 @@
+#ifndef __UR_TEMPLATE_MATCHER_H__
+#define __UR_TEMPLATE_MATCHER_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// A set of shell globs compiled into one NFA, so a name is checked against
+// all of them in a single pass over its characters: the active states of
+// every pattern are kept in one bitset and advanced together. Supported are
+// `?`, `*` anywhere, `[abc]`, `[a-z]`, `[!...]`/`[^...]` and `\` escapes.
+// Each pattern is added under a rule number, a match reports the mask of
+// the rules that accepted the whole name.
+#define GLOB_MAX_RULES 64
+#define GLOB_MAX_STATES 4096
+#define GLOB_WORDS (GLOB_MAX_STATES / 64)
+
+typedef enum {
+    GLOB_CHAR,   // ch
+    GLOB_ANY,    // ?
+    GLOB_CLASS,  // [...], arg indexes classes
+    GLOB_STAR,   // *
+    GLOB_ACCEPT  // end of the pattern for rule arg
+} GlobOp;
+
+typedef struct {
+    uint8_t op;
+    uint8_t ch;
+    uint16_t arg;
+} GlobState;
+
+typedef struct {
+    GlobState *states;
+    int state_count;
+    int state_capacity;
+    uint8_t (*classes)[32]; // one bit per byte value
+    int class_count;
+    uint64_t initial[GLOB_WORDS]; // states active before the first char
+} GlobSet;
+
+void glob_set_init(GlobSet *set);
+void glob_set_free(GlobSet *set);
+bool glob_set_add(GlobSet *set, const char *pattern, int rule);
+uint64_t glob_set_match(const GlobSet *set, const char *name);
+bool glob_set_empty(const GlobSet *set);
+
+#endif
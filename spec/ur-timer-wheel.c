@@ -0,0 +1,147 @@
+#include <stddef.h>
+#include <ur-timer-wheel.h>
+
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_SPAN ((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))
+
+static void slot_init(TimerWheelEntry *head) {
+    head->next = head;
+    head->prev = head;
+}
+
+static void slot_push(TimerWheelEntry *head, TimerWheelEntry *entry) {
+    entry->prev = head->prev;
+    entry->next = head;
+    head->prev->next = entry;
+    head->prev = entry;
+}
+
+static void entry_unlink(TimerWheelEntry *entry) {
+    entry->prev->next = entry->next;
+    entry->next->prev = entry->prev;
+    entry->next = entry->prev = NULL;
+}
+
+void timer_wheel_init(TimerWheel *wheel, uint64_t now_ms) {
+    for (int l = 0; l < TIMER_WHEEL_LEVELS; l++) {
+        for (int s = 0; s < TIMER_WHEEL_SLOTS; s++) {
+            slot_init(&wheel->slots[l][s]);
+        }
+    }
+    wheel->tick = now_ms / TIMER_WHEEL_TICK_MS;
+    wheel->count = 0;
+}
+
+void timer_wheel_entry_init(TimerWheelEntry *entry, timer_wheel_fire_t fire) {
+    entry->next = entry->prev = NULL;
+    entry->expires = 0;
+    entry->fire = fire;
+}
+
+bool timer_wheel_pending(const TimerWheelEntry *entry) {
+    return entry->next != NULL;
+}
+
+// Files the entry by its distance from the current tick: the level is the
+// coarsest one still needed, the slot comes from the absolute expiry
+static void wheel_insert(TimerWheel *wheel, TimerWheelEntry *entry) {
+    if (entry->expires < wheel->tick) {
+        entry->expires = wheel->tick;
+    }
+    uint64_t delta = entry->expires - wheel->tick;
+    if (delta >= TIMER_WHEEL_SPAN) {
+        entry->expires = wheel->tick + TIMER_WHEEL_SPAN - 1;
+        delta = TIMER_WHEEL_SPAN - 1;
+    }
+
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 &&
+           delta >= ((uint64_t)1 << (TIMER_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    int slot = (entry->expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    slot_push(&wheel->slots[level][slot], entry);
+}
+
+// Never fires early: the expiry is rounded up to the next tick
+void timer_wheel_add(TimerWheel *wheel, TimerWheelEntry *entry, uint64_t expires_ms) {
+    if (timer_wheel_pending(entry)) {
+        timer_wheel_cancel(wheel, entry);
+    }
+    entry->expires = (expires_ms + TIMER_WHEEL_TICK_MS - 1) / TIMER_WHEEL_TICK_MS;
+    wheel_insert(wheel, entry);
+    wheel->count++;
+}
+
+void timer_wheel_cancel(TimerWheel *wheel, TimerWheelEntry *entry) {
+    if (!timer_wheel_pending(entry)) {
+        return;
+    }
+    entry_unlink(entry);
+    wheel->count--;
+}
+
+// Moves one coarse slot down into the finer levels, returns its index
+static int wheel_cascade(TimerWheel *wheel, int level) {
+    int slot = (wheel->tick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK;
+    TimerWheelEntry *head = &wheel->slots[level][slot];
+
+    while (head->next != head) {
+        TimerWheelEntry *entry = head->next;
+        entry_unlink(entry);
+        wheel_insert(wheel, entry);
+    }
+    return slot;
+}
+
+// Fires every timer due at or before now_ms. The fire callback may re-add
+// its own entry, which then lands in a later tick.
+void timer_wheel_advance(TimerWheel *wheel, uint64_t now_ms) {
+    uint64_t target = now_ms / TIMER_WHEEL_TICK_MS;
+
+    while (wheel->tick <= target) {
+        TimerWheelEntry due;
+        TimerWheelEntry *head = &wheel->slots[0][wheel->tick & TIMER_WHEEL_MASK];
+        slot_init(&due);
+        while (head->next != head) {
+            TimerWheelEntry *entry = head->next;
+            entry_unlink(entry);
+            slot_push(&due, entry);
+        }
+        wheel->tick++;
+
+        // Level 0 wrapped: refill it from level 1, and so on upwards. Done
+        // right away so level 0 always holds the whole current block.
+        int slot = wheel->tick & TIMER_WHEEL_MASK;
+        for (int level = 1; slot == 0 && level < TIMER_WHEEL_LEVELS; level++) {
+            slot = wheel_cascade(wheel, level);
+        }
+
+        while (due.next != &due) {
+            TimerWheelEntry *entry = due.next;
+            entry_unlink(entry);
+            wheel->count--;
+            entry->fire(entry);
+        }
+    }
+}
+
+// Earliest time worth waking up for. Only level 0 is searched, beyond it
+// the next cascade point is returned, so this may be earlier than the
+// first real expiry but never later. False when no timer is pending.
+bool timer_wheel_next_ms(const TimerWheel *wheel, uint64_t *next_ms) {
+    if (wheel->count == 0) {
+        return false;
+    }
+
+    uint64_t tick = wheel->tick;
+    for (int slot = tick & TIMER_WHEEL_MASK; slot < TIMER_WHEEL_SLOTS; slot++) {
+        const TimerWheelEntry *head = &wheel->slots[0][slot];
+        if (head->next != head) {
+            *next_ms = ((tick & ~(uint64_t)TIMER_WHEEL_MASK) + slot) * TIMER_WHEEL_TICK_MS;
+            return true;
+        }
+    }
+    *next_ms = ((tick | TIMER_WHEEL_MASK) + 1) * TIMER_WHEEL_TICK_MS;
+    return true;
+}
@@ -0,0 +1,42 @@
+#ifndef __UR_TIMER_WHEEL_H__
+#define __UR_TIMER_WHEEL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Hierarchical timing wheel: TIMER_WHEEL_LEVELS wheels of TIMER_WHEEL_SLOTS
+// slots, each level TIMER_WHEEL_SLOTS times coarser than the one below.
+// Timers far out sit in a coarse slot and cascade down as their time
+// approaches, so add/cancel are O(1) whatever the number of timers.
+// At 5 ms ticks level 0 spans 320 ms, level 1 20 s, level 2 21 min.
+#define TIMER_WHEEL_TICK_MS 5
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4
+
+typedef struct TimerWheelEntry TimerWheelEntry;
+typedef void (*timer_wheel_fire_t)(TimerWheelEntry *entry);
+
+struct TimerWheelEntry {
+    TimerWheelEntry *next;
+    TimerWheelEntry *prev;
+    uint64_t expires; // in ticks
+    timer_wheel_fire_t fire;
+};
+
+// Not thread safe, the owner serialises access
+typedef struct {
+    TimerWheelEntry slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS]; // list heads
+    uint64_t tick; // next tick to be processed
+    int count;
+} TimerWheel;
+
+void timer_wheel_init(TimerWheel *wheel, uint64_t now_ms);
+void timer_wheel_entry_init(TimerWheelEntry *entry, timer_wheel_fire_t fire);
+bool timer_wheel_pending(const TimerWheelEntry *entry);
+void timer_wheel_add(TimerWheel *wheel, TimerWheelEntry *entry, uint64_t expires_ms);
+void timer_wheel_cancel(TimerWheel *wheel, TimerWheelEntry *entry);
+void timer_wheel_advance(TimerWheel *wheel, uint64_t now_ms);
+bool timer_wheel_next_ms(const TimerWheel *wheel, uint64_t *next_ms);
+
+#endif
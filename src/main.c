@@ -2,7 +2,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/inotify.h>
+#include <poll.h>
+#include <errno.h>
 #include <libudev.h>
 #include <dirent.h>
 #include <stdbool.h>
@@ -12,6 +13,7 @@
 #include <cssl.h>
 #include <libmavlink.h>
 #include <ur-discovery.h>
+#include <ur-event-outbox.h>
 
 void on_message(struct mosquitto* mosq, void* userdata, const struct mosquitto_message* message) {
     MqttThreadContext* context_temp = (MqttThreadContext*)userdata;
@@ -143,33 +145,17 @@ int main(int argc, char *argv[]) {
     #ifdef _DEBUG_MODE
     printf("Monitoring for devices matching these templates:\n");
         for (int i = 0; i < templates.count; i++) {
-        printf("  %s\n", templates.templates[i]);
+        printf("  %s%s\n", templates.templates[i],
+               templates.predicates[i].count ? " (with udev conditions)" : "");
+    }
+    for (int i = 0; i < templates.denied_count; i++) {
+        printf("  except %s%s\n", templates.denied[i],
+               templates.denied_predicates[i].count ? " (with udev conditions)" : "");
     }
     #endif
 
-    
-    // Scan existing devices first
-    scan_existing_devices(&templates);
-    #ifdef _DEBUG_MODE
-    printf("\nStarting device monitoring...\n");
-    #endif
-    int fd, wd;
-    char buffer[BUF_LEN];
-    
-    fd = inotify_init();
-    if (fd < 0) {
-        perror("inotify_init");
-        cleanup_threads();
-        return EXIT_FAILURE;
-    }
-    
-    wd = inotify_add_watch(fd, "/dev", IN_CREATE | IN_DELETE);
-    if (wd == -1) {
-        perror("inotify_add_watch");
-        close(fd);
-        cleanup_threads();
-        return EXIT_FAILURE;
-    }
+
+    struct udev_monitor *monitor = NULL;
 
     context = malloc(sizeof(MqttThreadContext));
     memset(context, 0, sizeof(MqttThreadContext));
@@ -194,7 +180,8 @@ int main(int argc, char *argv[]) {
     pthread_attr_init(&attr);
     pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
 
-    // Start MQTT thread
+    // The broker connection comes up while the ports are probed, results
+    // are held until it is there
     if (pthread_create(&context->mqtt_monitor.thread_id, &attr, 
                       mqtt_thread_func, context) != 0) {
         fprintf(stderr, "Failed to create MQTT thread\n");
@@ -210,34 +197,40 @@ int main(int argc, char *argv[]) {
     }
 
     pthread_attr_destroy(&attr);
+
+    // One reactor and a fixed set of probe workers serve every device
+    if (!start_probe_pool(&templates)) {
+        goto cleanup;
+    }
+
+    // Listen before scanning so nothing plugged in meanwhile is missed,
+    // devices seen twice are ignored the second time
+    monitor = start_hotplug_monitor();
+    if (!monitor) {
+        goto cleanup;
+    }
     
+    // Scan existing devices first
+    scan_existing_devices(&templates);
+    #ifdef _DEBUG_MODE
+    printf("\nStarting device monitoring...\n");
+    #endif
+    struct pollfd pfd[2] = {
+        { .fd = udev_monitor_get_fd(monitor), .events = POLLIN },
+        { .fd = outbox_get_fd(), .events = POLLIN }
+    };
+
     while (1) {
-        int length = read(fd, buffer, BUF_LEN);
-        if (length < 0) {
-            perror("read");
+        // While events wait for the broker, check back on it regularly
+        bool pending = outbox_flush();
+        if (poll(pfd, 2, pending ? OUTBOX_RETRY_MS : -1) < 0) {
+            if (errno != EINTR) {
+                perror("poll");
+            }
             continue;
         }
-        
-        int i = 0;
-        while (i < length) {
-            struct inotify_event *event = (struct inotify_event *) &buffer[i];
-            
-            if (event->len && is_monitored_device(event->name, &templates)) {
-                char full_path[DEV_PATH_LEN];
-                snprintf(full_path, sizeof(full_path), "/dev/%s", event->name);
-                
-                if (event->mask & IN_CREATE) {
-                    printf("\nDevice added at: %s\n", full_path);
-                    print_device_info(event->name);
-                    
-                    start_mavlink_check(full_path);
-                } else if (event->mask & IN_DELETE) {
-                    printf("\nDevice removed from: %s\n", full_path);
-                    unregister_device_mavrouter(full_path);
-                }
-            }
-            
-            i += EVENT_SIZE + event->len;
+        if (pfd[0].revents & POLLIN) {
+            handle_hotplug_event(monitor, &templates);
         }
     }
     cleanup:
@@ -256,9 +249,9 @@ int main(int argc, char *argv[]) {
     pthread_mutex_destroy(&context->mutex);
     free(context);
     
-    inotify_rm_watch(fd, wd);
-    close(fd);
+    stop_hotplug_monitor(monitor);
     cleanup_threads();
+    free_templates(&templates);
     
     return EXIT_SUCCESS;
 }
\ No newline at end of file
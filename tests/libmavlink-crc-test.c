@@ -0,0 +1,71 @@
+// libmavlink_crc_accumulate_buffer must give exactly what checksum.h's
+// crc_accumulate_buffer gives, for any length, alignment and split
+#include <stdio.h>
+#include <stdint.h>
+#include <libmavlink.h>
+
+#define MAX_LENGTH 1024
+#define ALIGNMENTS 8
+#define SEEDS 4
+
+static uint8_t data[MAX_LENGTH + ALIGNMENTS];
+static uint32_t rng_state = 0x2545F491;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static uint16_t reference(uint16_t crc, const uint8_t *buf, size_t length) {
+    crc_accumulate_buffer(&crc, (const char *)buf, (uint16_t)length);
+    return crc;
+}
+
+static uint16_t sliced(uint16_t crc, const uint8_t *buf, size_t length) {
+    libmavlink_crc_accumulate_buffer(&crc, buf, length);
+    return crc;
+}
+
+int main(void) {
+    long cases = 0;
+    long failures = 0;
+
+    libmavlink_init();
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)rng();
+    }
+
+    // "123456789" is the catalogue check value of CRC-16/MCRF4XX
+    uint16_t check = sliced(X25_INIT_CRC, (const uint8_t *)"123456789", 9);
+    if (check != 0x6F91) {
+        printf("FAIL: check value 0x%04X, expected 0x6F91\n", check);
+        failures++;
+    }
+
+    for (size_t length = 0; length <= MAX_LENGTH; length++) {
+        for (size_t align = 0; align < ALIGNMENTS; align++) {
+            const uint8_t *buf = data + align;
+            for (int seed = 0; seed < SEEDS; seed++) {
+                uint16_t init = seed == 0 ? X25_INIT_CRC : (uint16_t)rng();
+                uint16_t expected = reference(init, buf, length);
+                size_t cut = length ? rng() % (length + 1) : 0;
+
+                cases += 2;
+                if (sliced(init, buf, length) != expected) {
+                    printf("FAIL: length %zu, alignment %zu, init 0x%04X\n", length, align, init);
+                    failures++;
+                }
+                // Accumulating in two parts must not matter
+                if (sliced(sliced(init, buf, cut), buf + cut, length - cut) != expected) {
+                    printf("FAIL: length %zu split at %zu, alignment %zu\n", length, cut, align);
+                    failures++;
+                }
+            }
+        }
+    }
+
+    printf("%ld cases, %ld failures\n", cases, failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,65 @@
+// mavlink_get_msg_entry's direct-indexed table must resolve every 24-bit
+// message id exactly like mavlink_helpers.h's bisection over
+// MAVLINK_MESSAGE_CRCS, which libmavlink.h replaces
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <libmavlink.h>
+
+#define MSGID_LIMIT (1u << 24)
+
+static const mavlink_msg_entry_t message_crcs[] = MAVLINK_MESSAGE_CRCS;
+
+// mavlink_helpers.h's mavlink_get_msg_entry, which MAVLINK_GET_MSG_ENTRY
+// compiles out
+static const mavlink_msg_entry_t *bisect(uint32_t msgid) {
+    uint32_t low = 0;
+    uint32_t high = sizeof(message_crcs) / sizeof(message_crcs[0]) - 1;
+
+    while (low < high) {
+        uint32_t mid = (low + 1 + high) / 2;
+        if (msgid < message_crcs[mid].msgid) {
+            high = mid - 1;
+            continue;
+        }
+        if (msgid > message_crcs[mid].msgid) {
+            low = mid;
+            continue;
+        }
+        low = mid;
+        break;
+    }
+    if (message_crcs[low].msgid != msgid) {
+        return NULL;
+    }
+    return &message_crcs[low];
+}
+
+int main(void) {
+    long found = 0;
+    long failures = 0;
+
+    libmavlink_init();
+    for (uint32_t msgid = 0; msgid < MSGID_LIMIT; msgid++) {
+        const mavlink_msg_entry_t *expected = bisect(msgid);
+        const mavlink_msg_entry_t *entry = mavlink_get_msg_entry(msgid);
+
+        if (!expected != !entry || (entry && memcmp(entry, expected, sizeof(*entry)) != 0)) {
+            if (failures < 10) {
+                printf("FAIL: message %u %s\n", msgid, entry ? "resolves differently" : "not found");
+            }
+            failures++;
+        }
+        found += entry != NULL;
+    }
+
+    // Each entry of the dialect exactly once
+    if (found != (long)(sizeof(message_crcs) / sizeof(message_crcs[0]))) {
+        printf("FAIL: %ld ids resolve, the dialect has %zu messages\n", found,
+               sizeof(message_crcs) / sizeof(message_crcs[0]));
+        failures++;
+    }
+
+    printf("%u ids, %ld messages, %ld failures\n", MSGID_LIMIT, found, failures);
+    return failures ? 1 : 0;
+}
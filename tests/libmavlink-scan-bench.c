@@ -0,0 +1,122 @@
+// Throughput of libmavlink_parse_buffer against the per-byte
+// libmavlink_parse_char loop, fed in serial reader sized chunks
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <libmavlink.h>
+
+#define DATA_SIZE (8 << 20)
+#define CHUNK 4096
+#define RUNS 5
+
+typedef enum {
+    INPUT_NOISE,
+    INPUT_RANDOM,
+    INPUT_MAVLINK,
+    INPUT_NMEA,
+    INPUT_KINDS
+} InputKind;
+
+static const char *input_names[INPUT_KINDS] = {
+    "noise without STX", "random bytes", "MAVLink stream", "NMEA text"
+};
+
+static uint8_t data[DATA_SIZE];
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fill(InputKind kind) {
+    static const char nmea[] = "$GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*47\r\n";
+    mavlink_message_t msg;
+    int n = 0;
+
+    srand(1);
+    switch (kind) {
+    case INPUT_NOISE:
+        for (int i = 0; i < DATA_SIZE; i++) {
+            uint8_t b = (uint8_t)rand();
+            data[i] = b == MAVLINK_STX || b == MAVLINK_STX_MAVLINK1 ? 0x55 : b;
+        }
+        break;
+    case INPUT_RANDOM:
+        for (int i = 0; i < DATA_SIZE; i++) {
+            data[i] = (uint8_t)rand();
+        }
+        break;
+    case INPUT_MAVLINK:
+        while (n < DATA_SIZE - MAVLINK_MAX_PACKET_LEN) {
+            switch (rand() % 3) {
+            case 0:
+                mavlink_msg_heartbeat_pack(1, 1, &msg, MAV_TYPE_QUADROTOR, MAV_AUTOPILOT_ARDUPILOTMEGA,
+                                           0, 0, MAV_STATE_STANDBY);
+                break;
+            case 1:
+                mavlink_msg_attitude_pack(1, 1, &msg, n, 0.1f, 0.2f, 0.3f, 0, 0, 0);
+                break;
+            default:
+                mavlink_msg_ahrs2_pack(1, 1, &msg, 0.1f, 0.2f, 0.3f, 10.0f, 1, 2);
+                break;
+            }
+            n += mavlink_msg_to_send_buffer(data + n, &msg);
+        }
+        memset(data + n, 0, DATA_SIZE - n);
+        break;
+    default:
+        for (int i = 0; i < DATA_SIZE; i++) {
+            data[i] = nmea[i % (sizeof(nmea) - 1)];
+        }
+        break;
+    }
+}
+
+// Best of RUNS in seconds; frames counts what was decoded
+static double measure(bool bulk, unsigned *frames) {
+    double best = 1e9;
+
+    for (int run = 0; run < RUNS; run++) {
+        libmavlink_parser_t parser;
+        mavlink_message_t msg;
+        mavlink_status_t status;
+
+        libmavlink_parser_init(&parser);
+        double start = now_s();
+        for (int off = 0; off < DATA_SIZE; off += CHUNK) {
+            if (bulk) {
+                int pos = 0;
+                while (pos < CHUNK) {
+                    libmavlink_parse_buffer(&parser, data + off, CHUNK, &pos, &msg, &status);
+                }
+            } else {
+                for (int i = 0; i < CHUNK; i++) {
+                    libmavlink_parse_char(&parser, data[off + i], &msg, &status);
+                }
+            }
+        }
+        double elapsed = now_s() - start;
+        if (elapsed < best) {
+            best = elapsed;
+        }
+        *frames = parser.stats.frames_ok;
+    }
+    return best;
+}
+
+int main(void) {
+    for (int kind = 0; kind < INPUT_KINDS; kind++) {
+        unsigned frames_per_byte, frames_bulk;
+
+        fill(kind);
+        double per_byte = measure(false, &frames_per_byte);
+        double bulk = measure(true, &frames_bulk);
+        printf("%-18s per-byte %7.0f MB/s, parse_buffer %7.0f MB/s (x%.1f), %u frames%s\n",
+               input_names[kind], DATA_SIZE / per_byte / 1e6, DATA_SIZE / bulk / 1e6,
+               per_byte / bulk, frames_bulk, frames_bulk == frames_per_byte ? "" : " MISMATCH");
+    }
+    return 0;
+}
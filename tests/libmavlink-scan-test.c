@@ -0,0 +1,246 @@
+// libmavlink_parse_buffer skips to start bytes with whichever scan this
+// build has; it must decode exactly what libmavlink_parse_char does one
+// byte at a time: same messages, counters and state at the end of input
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <libmavlink.h>
+
+#if defined(LIBMAVLINK_SCALAR_SCAN)
+#define SCAN_NAME "scalar"
+#elif defined(__AVX2__)
+#define SCAN_NAME "AVX2"
+#elif defined(__SSE2__)
+#define SCAN_NAME "SSE2"
+#elif defined(__ARM_NEON)
+#define SCAN_NAME "NEON"
+#else
+#define SCAN_NAME "scalar"
+#endif
+
+#define INPUT_SIZE (16 * 1024)
+#define MAX_DECODED 1024
+#define SKIPPED 77 // ctest SKIP_RETURN_CODE
+
+typedef struct {
+    uint32_t msgid;
+    uint8_t seq;
+    uint8_t sysid;
+    uint8_t len;
+    uint8_t magic;
+    uint16_t checksum;
+    uint8_t payload[MAVLINK_MAX_PAYLOAD_LEN];
+} Decoded;
+
+typedef struct {
+    int count;
+    Decoded decoded[MAX_DECODED];
+    unsigned frames_ok;
+    unsigned crc_errors;
+    unsigned parse_errors;
+    uint8_t parse_state;
+    uint8_t packet_idx;
+} Outcome;
+
+static uint8_t input[INPUT_SIZE];
+static Outcome expected;
+static Outcome actual;
+static uint32_t rng_state = 0x9E3779B9;
+static long runs;
+static long failures;
+
+static uint32_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+// A byte that is neither start byte
+static uint8_t noise(void) {
+    uint8_t b = (uint8_t)rng();
+    return b == MAVLINK_STX || b == MAVLINK_STX_MAVLINK1 ? 0x55 : b;
+}
+
+static void record(Outcome *out, const mavlink_message_t *msg) {
+    if (out->count == MAX_DECODED) {
+        return;
+    }
+    Decoded *d = &out->decoded[out->count++];
+    memset(d, 0, sizeof(*d));
+    d->msgid = msg->msgid;
+    d->seq = msg->seq;
+    d->sysid = msg->sysid;
+    d->len = msg->len;
+    d->magic = msg->magic;
+    d->checksum = msg->checksum;
+    memcpy(d->payload, _MAV_PAYLOAD(msg), msg->len);
+}
+
+static void finish(Outcome *out, const libmavlink_parser_t *parser) {
+    out->frames_ok = parser->stats.frames_ok;
+    out->crc_errors = parser->stats.crc_errors;
+    out->parse_errors = parser->stats.parse_errors;
+    out->parse_state = parser->status.parse_state;
+    out->packet_idx = parser->status.packet_idx;
+}
+
+static void run_per_byte(const uint8_t *buf, int length, Outcome *out) {
+    libmavlink_parser_t parser;
+    mavlink_message_t msg;
+    mavlink_status_t status;
+
+    memset(out, 0, sizeof(*out));
+    libmavlink_parser_init(&parser);
+    for (int i = 0; i < length; i++) {
+        if (libmavlink_parse_char(&parser, buf[i], &msg, &status)) {
+            record(out, &msg);
+        }
+    }
+    finish(out, &parser);
+}
+
+// Fed in reads of chunk bytes, like the serial reader does
+static void run_buffered(const uint8_t *buf, int length, int chunk, Outcome *out) {
+    libmavlink_parser_t parser;
+    mavlink_message_t msg;
+    mavlink_status_t status;
+
+    memset(out, 0, sizeof(*out));
+    libmavlink_parser_init(&parser);
+    for (int off = 0; off < length; off += chunk) {
+        int n = length - off < chunk ? length - off : chunk;
+        int pos = 0;
+        while (pos < n) {
+            if (libmavlink_parse_buffer(&parser, buf + off, n, &pos, &msg, &status)) {
+                record(out, &msg);
+            }
+        }
+    }
+    finish(out, &parser);
+}
+
+static void check(const char *name, const uint8_t *buf, int length) {
+    static const int chunks[] = { 1, 3, 15, 16, 17, 31, 32, 33, 64, 1000, INPUT_SIZE };
+
+    run_per_byte(buf, length, &expected);
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        run_buffered(buf, length, chunks[i], &actual);
+        runs++;
+        if (memcmp(&expected, &actual, sizeof(expected)) != 0) {
+            printf("FAIL: %s, %d bytes in chunks of %d: %d/%u/%u/%u frames/ok/crc/parse and state %u, "
+                   "expected %d/%u/%u/%u and state %u\n",
+                   name, length, chunks[i], actual.count, actual.frames_ok, actual.crc_errors,
+                   actual.parse_errors, actual.parse_state, expected.count, expected.frames_ok,
+                   expected.crc_errors, expected.parse_errors, expected.parse_state);
+            failures++;
+        }
+    }
+}
+
+// One frame in either framing. AHRS2 is ardupilotmega only, so it takes
+// the path that rechecks frames failing the common CRC.
+static int put_frame(uint8_t *buf, bool mavlink1) {
+    mavlink_status_t *tx = mavlink_get_channel_status(MAVLINK_COMM_0);
+    mavlink_message_t msg;
+
+    if (mavlink1) {
+        tx->flags |= MAVLINK_STATUS_FLAG_OUT_MAVLINK1;
+    } else {
+        tx->flags &= ~MAVLINK_STATUS_FLAG_OUT_MAVLINK1;
+    }
+    switch (rng() % 4) {
+    case 0:
+        mavlink_msg_heartbeat_pack(1, 1, &msg, MAV_TYPE_QUADROTOR, MAV_AUTOPILOT_ARDUPILOTMEGA,
+                                   0, rng(), MAV_STATE_STANDBY);
+        break;
+    case 1:
+        mavlink_msg_attitude_pack(1, 1, &msg, rng(), 0.1f, 0.2f, 0.3f, 0, 0, 0);
+        break;
+    case 2:
+        mavlink_msg_ahrs2_pack(1, 1, &msg, 0.1f, 0.2f, 0.3f, 10.0f, rng(), rng());
+        break;
+    default:
+        mavlink_msg_statustext_pack(1, 1, &msg, MAV_SEVERITY_INFO, "scan test", 0, 0);
+        break;
+    }
+    return mavlink_msg_to_send_buffer(buf, &msg);
+}
+
+static int put_noise(uint8_t *buf, int n) {
+    for (int i = 0; i < n; i++) {
+        buf[i] = noise();
+    }
+    return n;
+}
+
+// Frames whose start byte lands on and around the 16 and 32-byte blocks
+static void check_block_boundaries(void) {
+    static const int offsets[] = { 0, 1, 14, 15, 16, 17, 30, 31, 32, 33, 47, 48, 63, 64, 65 };
+    char name[64];
+
+    for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+        for (int mavlink1 = 0; mavlink1 <= 1; mavlink1++) {
+            int n = put_noise(input, offsets[i]);
+            n += put_frame(input + n, mavlink1);
+            // Then a stray start byte on the next boundary, then a frame
+            n += put_noise(input + n, 64 - n % 32 + offsets[i] % 32);
+            input[n++] = mavlink1 ? MAVLINK_STX_MAVLINK1 : MAVLINK_STX;
+            n += put_noise(input + n, offsets[i]);
+            n += put_frame(input + n, mavlink1);
+            snprintf(name, sizeof(name), "start byte at %d, MAVLink %d", offsets[i], mavlink1 ? 1 : 2);
+            check(name, input, n);
+        }
+    }
+}
+
+// Frames of both framings, some corrupted, between runs of noise
+static int fill_stream(void) {
+    int n = 0;
+
+    while (n < INPUT_SIZE - 2 * MAVLINK_MAX_PACKET_LEN) {
+        n += put_noise(input + n, rng() % 70);
+        if (rng() % 8 == 0) {
+            input[n++] = rng() % 2 ? MAVLINK_STX : MAVLINK_STX_MAVLINK1;
+        }
+        int start = n;
+        n += put_frame(input + n, rng() % 2);
+        if (rng() % 6 == 0) {
+            input[start + 1 + rng() % (n - start - 1)] ^= 1 << rng() % 8;
+        }
+    }
+    return n;
+}
+
+int main(void) {
+    char name[64];
+
+#if defined(__AVX2__) && !defined(LIBMAVLINK_SCALAR_SCAN)
+    if (!__builtin_cpu_supports("avx2")) {
+        printf("AVX2 not supported by this CPU, skipped\n");
+        return SKIPPED;
+    }
+#endif
+
+    check_block_boundaries();
+
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < INPUT_SIZE; j++) {
+            input[j] = (uint8_t)rng();
+        }
+        check("random bytes", input, INPUT_SIZE);
+    }
+
+    for (int i = 0; i < 4; i++) {
+        int length = fill_stream();
+        check("frames in noise", input, length);
+        // Cut anywhere, most of all in the middle of a frame
+        for (int cut = 1; cut <= 600; cut++) {
+            snprintf(name, sizeof(name), "frames in noise cut at %d", cut);
+            check(name, input, cut);
+        }
+    }
+
+    printf("%s scan: %ld runs, %ld failures\n", SCAN_NAME, runs, failures);
+    return failures ? 1 : 0;
+}